@@ -0,0 +1,565 @@
+/*
+Copyright 2024 Vlad Mesco
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+// Finds files embedded in the buffer by their magic numbers, the way
+// binwalk does for firmware images.
+//
+// Every signature is a magic string at some offset into the file it
+// starts. All signatures are looked for in a single pass: a bitmap of
+// their first two bytes rules out most positions with one lookup, and the
+// few positions which get past it are compared against the signatures
+// starting with those two bytes. Where the format allows, the header is
+// parsed to get at the length of the embedded file, and to weed out
+// magic numbers which turn up by chance.
+//
+// The buffer is cut into chunks which are scanned in parallel.
+
+// NOLINTBEGIN
+#ifndef _XOPEN_SOURCE
+# define _XOPEN_SOURCE 600
+#endif
+// NOLINTEND
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+extern void
+run_parallel(size_t, void (*)(size_t, void*), void*);
+
+#define CHUNK (16u << 20)
+#define INFO 48
+
+// returns 0 if this isn't really one. *start is where the file starts if
+// the magic is where it should be; the parser may know better. Sets
+// *length to 0 if the length can't be told from the header
+typedef int (*parser)(const unsigned char* p, size_t n, size_t* start,
+        size_t* length, char* info);
+
+struct signature {
+    const char* name;
+    size_t offset;              // of the magic into the file
+    const unsigned char* magic;
+    size_t n;
+    parser parse;
+};
+
+struct hit {
+    size_t start;
+    size_t length;
+    int sig;
+    char info[INFO];
+};
+
+struct hits {
+    struct hit* v;
+    size_t n, cap;
+};
+
+// reading header fields; anything past the end of the buffer reads as 0
+// and the callers check the bounds they care about
+static uint64_t rd(const unsigned char* p, size_t n, size_t at, int size, int le)
+{
+    uint64_t r = 0;
+    if(at > n || n - at < (size_t)size) return 0;
+    for(int i = 0; i < size; ++i) {
+        r |= (uint64_t)p[at + i] << (8 * (le ? i : size - 1 - i));
+    }
+    return r;
+}
+
+// copy up to len printable characters of a name field into info
+static void copy_name(char* info, const char* prefix,
+        const unsigned char* p, size_t n, size_t at, size_t len)
+{
+    int k = snprintf(info, INFO, "%s", prefix);
+    if(k < 0) return;
+    for(size_t i = 0; i < len && at + i < n && k + 1 < INFO; ++i) {
+        unsigned char c = p[at + i];
+        if(c == 0) break;
+        info[k++] = (c >= 0x20 && c < 0x7F) ? c : '?';
+    }
+    info[k] = '\0';
+}
+
+static int parse_elf(const unsigned char* p, size_t n, size_t* start, size_t* length, char* info)
+{
+    size_t s = *start;
+    if(n - s < 64) return 0;
+    int cls = p[s + 4], data = p[s + 5];
+    if(cls < 1 || cls > 2 || data < 1 || data > 2 || p[s + 6] != 1) return 0;
+    int w = (cls == 2) ? 8 : 4, le = (data == 1);
+
+    uint64_t phoff = rd(p, n, s + 24 + w, w, le);
+    uint64_t shoff = rd(p, n, s + 24 + 2 * w, w, le);
+    size_t at = s + 24 + 3 * w + 4 + 2;     // past e_flags and e_ehsize
+    uint64_t phentsize = rd(p, n, at, 2, le);
+    uint64_t phnum = rd(p, n, at + 2, 2, le);
+    uint64_t shentsize = rd(p, n, at + 4, 2, le);
+    uint64_t shnum = rd(p, n, at + 6, 2, le);
+
+    uint64_t end = (cls == 2) ? 64 : 52;
+    if(phoff + phnum * phentsize > end) end = phoff + phnum * phentsize;
+    if(shoff + shnum * shentsize > end) end = shoff + shnum * shentsize;
+    // segments may come after the section headers
+    for(uint64_t i = 0; i < phnum && phentsize >= 8u * w; ++i) {
+        size_t ph = s + phoff + i * phentsize;
+        if(phoff > n || ph >= n) break;
+        uint64_t off = rd(p, n, ph + ((cls == 2) ? 8 : 4), w, le);
+        uint64_t filesz = rd(p, n, ph + ((cls == 2) ? 32 : 16), w, le);
+        if(off + filesz > end) end = off + filesz;
+    }
+    *length = end;
+    snprintf(info, INFO, "ELF %d-bit %s, machine %u",
+            8 * w, le ? "LSB" : "MSB", (unsigned)rd(p, n, s + 18, 2, le));
+    return 1;
+}
+
+static int parse_png(const unsigned char* p, size_t n, size_t* start, size_t* length, char* info)
+{
+    size_t s = *start;
+    if(n - s < 33 || memcmp(p + s + 12, "IHDR", 4) != 0) return 0;
+    snprintf(info, INFO, "PNG image, %ux%u",
+            (unsigned)rd(p, n, s + 16, 4, 0), (unsigned)rd(p, n, s + 20, 4, 0));
+    size_t at = s + 8;
+    while(n - at >= 12) {
+        uint64_t len = rd(p, n, at, 4, 0);
+        if(len > 0x7FFFFFFFu) return 0;
+        int iend = (memcmp(p + at + 4, "IEND", 4) == 0);
+        at += 12 + len;
+        if(iend) {
+            *length = at - s;
+            return 1;
+        }
+        if(at > n) break;
+    }
+    *length = 0;
+    return 1;
+}
+
+static int parse_gzip(const unsigned char* p, size_t n, size_t* start, size_t* length, char* info)
+{
+    size_t s = *start;
+    if(n - s < 18) return 0;
+    int flags = p[s + 3];
+    int xfl = p[s + 8], os = p[s + 9];
+    if(flags & 0xE0) return 0;
+    if((xfl != 0 && xfl != 2 && xfl != 4) || (os > 13 && os != 255)) return 0;
+    *length = 0;
+    size_t at = s + 10;
+    if(flags & 0x04) at += 2 + rd(p, n, at, 2, 1);   // FEXTRA
+    if(flags & 0x08) copy_name(info, "gzip, ", p, n, at, 32);  // FNAME
+    else snprintf(info, INFO, "gzip");
+    return 1;
+}
+
+static int parse_squashfs(const unsigned char* p, size_t n, size_t* start, size_t* length, char* info)
+{
+    size_t s = *start;
+    if(n - s < 96) return 0;
+    int le = (p[s] == 'h');
+    uint64_t block = rd(p, n, s + 12, 4, le);
+    unsigned major = (unsigned)rd(p, n, s + 28, 2, le);
+    unsigned minor = (unsigned)rd(p, n, s + 30, 2, le);
+    if(major < 2 || major > 4) return 0;
+    if(major == 4 && (block < 4096 || block > (1u << 20) || (block & (block - 1))))
+        return 0;
+    *length = (major == 4) ? rd(p, n, s + 40, 8, le) : 0;
+    snprintf(info, INFO, "squashfs %u.%u, %s", major, minor, le ? "LE" : "BE");
+    return 1;
+}
+
+static int parse_zip_entry(const unsigned char* p, size_t n, size_t* start, size_t* length, char* info)
+{
+    size_t s = *start;
+    if(n - s < 30) return 0;
+    unsigned flags = (unsigned)rd(p, n, s + 6, 2, 1);
+    uint64_t csize = rd(p, n, s + 18, 4, 1);
+    uint64_t namelen = rd(p, n, s + 26, 2, 1);
+    uint64_t extralen = rd(p, n, s + 28, 2, 1);
+    // with bit 3 the sizes come after the data
+    *length = (flags & 8) ? 0 : 30 + namelen + extralen + csize;
+    copy_name(info, "zip entry, ", p, n, s + 30, namelen);
+    return 1;
+}
+
+static int parse_zip_end(const unsigned char* p, size_t n, size_t* start, size_t* length, char* info)
+{
+    // this is the end of central directory record; the archive starts
+    // as far back as the central directory and everything before it
+    size_t s = *start;
+    if(n - s < 22) return 0;
+    uint64_t cdsize = rd(p, n, s + 12, 4, 1);
+    uint64_t cdoff = rd(p, n, s + 16, 4, 1);
+    if(cdsize + cdoff > s) return 0;
+    *start = s - cdsize - cdoff;
+    *length = s + 22 + rd(p, n, s + 20, 2, 1) - *start;
+    snprintf(info, INFO, "zip archive, %u entries", (unsigned)rd(p, n, s + 8, 2, 1));
+    return 1;
+}
+
+static int parse_jpeg(const unsigned char* p, size_t n, size_t* start, size_t* length, char* info)
+{
+    size_t s = *start;
+    unsigned width = 0, height = 0;
+    size_t at = s + 2;
+    *length = 0;
+    while(n - at >= 4 && at < n) {
+        if(p[at] != 0xFF) break;
+        int marker = p[at + 1];
+        if(marker == 0xD9) {
+            *length = at + 2 - s;
+            break;
+        }
+        if(marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7) || marker == 0xFF) {
+            at += (marker == 0xFF) ? 1 : 2;
+            continue;
+        }
+        size_t seglen = (size_t)rd(p, n, at + 2, 2, 0);
+        if(seglen < 2) break;
+        if((marker == 0xC0 || marker == 0xC2) && n - at >= 9) {
+            height = (unsigned)rd(p, n, at + 5, 2, 0);
+            width = (unsigned)rd(p, n, at + 7, 2, 0);
+        }
+        at += 2 + seglen;
+        if(marker == 0xDA) {
+            // entropy coded data; FF is escaped as FF 00, and RSTn show up
+            while(at + 1 < n && !(p[at] == 0xFF && p[at + 1] != 0
+                        && !(p[at + 1] >= 0xD0 && p[at + 1] <= 0xD7))) {
+                const unsigned char* ff = memchr(p + at + 1, 0xFF, n - at - 1);
+                if(!ff) {
+                    at = n;
+                    break;
+                }
+                at = ff - p;
+            }
+        }
+    }
+    if(!width) return 0;
+    snprintf(info, INFO, "JPEG image, %ux%u", width, height);
+    return 1;
+}
+
+static int parse_bzip2(const unsigned char* p, size_t n, size_t* start, size_t* length, char* info)
+{
+    size_t s = *start;
+    if(n - s < 10 || p[s + 3] < '1' || p[s + 3] > '9') return 0;
+    if(memcmp(p + s + 4, "\x31\x41\x59\x26\x53\x59", 6) != 0
+            && memcmp(p + s + 4, "\x17\x72\x45\x38\x50\x90", 6) != 0)
+        return 0;
+    *length = 0;
+    snprintf(info, INFO, "bzip2, %c00k blocks", p[s + 3]);
+    return 1;
+}
+
+static int parse_7z(const unsigned char* p, size_t n, size_t* start, size_t* length, char* info)
+{
+    size_t s = *start;
+    if(n - s < 32 || p[s + 6] != 0) return 0;
+    uint64_t off = rd(p, n, s + 12, 8, 1);
+    uint64_t size = rd(p, n, s + 20, 8, 1);
+    if(off > ((uint64_t)1 << 48) || size > ((uint64_t)1 << 48)) return 0;
+    *length = 32 + off + size;
+    snprintf(info, INFO, "7-zip %u.%u", p[s + 6], p[s + 7]);
+    return 1;
+}
+
+static int parse_uimage(const unsigned char* p, size_t n, size_t* start, size_t* length, char* info)
+{
+    size_t s = *start;
+    if(n - s < 64) return 0;
+    *length = 64 + rd(p, n, s + 12, 4, 0);
+    copy_name(info, "uImage, ", p, n, s + 32, 32);
+    return 1;
+}
+
+static int parse_dtb(const unsigned char* p, size_t n, size_t* start, size_t* length, char* info)
+{
+    size_t s = *start;
+    if(n - s < 40) return 0;
+    uint64_t size = rd(p, n, s + 4, 4, 0);
+    unsigned version = (unsigned)rd(p, n, s + 20, 4, 0);
+    if(size < 40 || version < 1 || version > 17) return 0;
+    *length = size;
+    snprintf(info, INFO, "device tree v%u", version);
+    return 1;
+}
+
+static int parse_tar(const unsigned char* p, size_t n, size_t* start, size_t* length, char* info)
+{
+    size_t s = *start;
+    if(n - s < 512) return 0;
+    uint64_t size = 0;
+    for(int i = 0; i < 12; ++i) {
+        unsigned char c = p[s + 124 + i];
+        if(c == 0 || c == ' ') {
+            if(i == 0) return 0;
+            break;
+        }
+        if(c < '0' || c > '7') return 0;
+        size = size * 8 + (c - '0');
+    }
+    *length = 512 + (size + 511) / 512 * 512;
+    copy_name(info, "tar entry, ", p, n, s, 100);
+    return 1;
+}
+
+static int parse_cpio(const unsigned char* p, size_t n, size_t* start, size_t* length, char* info)
+{
+    size_t s = *start;
+    if(n - s < 110) return 0;
+    uint64_t field[2];
+    const size_t at[2] = { 54, 94 };   // c_filesize, c_namesize
+    for(int f = 0; f < 2; ++f) {
+        field[f] = 0;
+        for(int i = 0; i < 8; ++i) {
+            unsigned char c = p[s + at[f] + i];
+            int d = (c >= '0' && c <= '9') ? c - '0'
+                  : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+                  : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+            if(d < 0) return 0;
+            field[f] = field[f] * 16 + d;
+        }
+    }
+    *length = (110 + field[1] + 3) / 4 * 4 + (field[0] + 3) / 4 * 4;
+    copy_name(info, "cpio entry, ", p, n, s + 110, field[1]);
+    return 1;
+}
+
+#define SIG(name, offset, magic, parse) \
+    { name, offset, (const unsigned char*)magic, sizeof(magic) - 1, parse }
+static const struct signature builtin[] = {
+    SIG("elf", 0, "\x7f" "ELF", parse_elf),
+    SIG("png", 0, "\x89PNG\r\n\x1a\n", parse_png),
+    SIG("gzip", 0, "\x1f\x8b\x08", parse_gzip),
+    SIG("squashfs", 0, "hsqs", parse_squashfs),
+    SIG("squashfs", 0, "sqsh", parse_squashfs),
+    SIG("zip", 0, "PK\x03\x04", parse_zip_entry),
+    SIG("zip", 0, "PK\x05\x06", parse_zip_end),
+    SIG("jpeg", 0, "\xff\xd8\xff", parse_jpeg),
+    SIG("xz", 0, "\xfd" "7zXZ\0", NULL),
+    SIG("bzip2", 0, "BZh", parse_bzip2),
+    SIG("7z", 0, "7z\xbc\xaf\x27\x1c", parse_7z),
+    SIG("uimage", 0, "\x27\x05\x19\x56", parse_uimage),
+    SIG("dtb", 0, "\xd0\x0d\xfe\xed", parse_dtb),
+    SIG("tar", 257, "ustar", parse_tar),
+    SIG("cpio", 0, "070701", parse_cpio),
+    SIG("zstd", 0, "\x28\xb5\x2f\xfd", NULL),
+    SIG("lz4", 0, "\x04\x22\x4d\x18", NULL),
+    SIG("ubi", 0, "UBI#", NULL),
+    SIG("android", 0, "ANDROID!", NULL),
+    SIG("pdf", 0, "%PDF-", NULL),
+};
+#undef SIG
+#define NBUILTIN (sizeof(builtin) / sizeof(builtin[0]))
+
+// all signatures: the built in ones, then the ones from carve_add()
+static struct signature* sigs = NULL;
+static size_t nsigs = 0;
+
+// signatures by their first two bytes
+static unsigned char first2[65536 / 8];
+static int head[65536];
+static int* next = NULL;
+
+static int init_signatures(void)
+{
+    if(sigs) return 1;
+    sigs = malloc(sizeof(builtin));
+    if(!sigs) return 0;
+    memcpy(sigs, builtin, sizeof(builtin));
+    nsigs = NBUILTIN;
+    return 1;
+}
+
+static int build_table(void)
+{
+    int* v = realloc(next, nsigs * sizeof(int));
+    if(!v) return 0;
+    next = v;
+    memset(first2, 0, sizeof(first2));
+    for(int k = 0; k < 65536; ++k) head[k] = -1;
+    // backwards, so the chains list signatures in order
+    for(size_t i = nsigs; i-- > 0; ) {
+        unsigned k = sigs[i].magic[0] | (sigs[i].magic[1] << 8);
+        first2[k >> 3] |= 1u << (k & 7);
+        next[i] = head[k];
+        head[k] = (int)i;
+    }
+    return 1;
+}
+
+/** carve_add
+  *
+  * Adds a signature: `name' files have magic[n] at offset. Their length
+  * is never known. The magic needs to be at least 2 bytes long.
+  * Returns 0 if it isn't, or if we ran out of memory.
+  */
+int
+carve_add(const char* name, size_t offset, const unsigned char* magic, size_t n)
+{
+    if(n < 2 || !init_signatures()) return 0;
+    struct signature* v = realloc(sigs, (nsigs + 1) * sizeof(struct signature));
+    if(!v) return 0;
+    sigs = v;
+    char* nm = strdup(name);
+    unsigned char* mg = malloc(n);
+    if(!nm || !mg) {
+        free(nm);
+        free(mg);
+        return 0;
+    }
+    memcpy(mg, magic, n);
+    sigs[nsigs].name = nm;
+    sigs[nsigs].offset = offset;
+    sigs[nsigs].magic = mg;
+    sigs[nsigs].n = n;
+    sigs[nsigs].parse = NULL;
+    nsigs++;
+    return 1;
+}
+
+struct carve_job {
+    const unsigned char* p;
+    size_t n;
+    struct hits* out;   // one per chunk
+    int failed;
+};
+
+static int push(struct hits* h, size_t start, size_t length, int sig, const char* info)
+{
+    if(h->n >= h->cap) {
+        size_t cap = h->cap ? h->cap * 2 : 64;
+        void* v = realloc(h->v, cap * sizeof(struct hit));
+        if(!v) return 0;
+        h->v = v;
+        h->cap = cap;
+    }
+    struct hit* e = &h->v[h->n++];
+    e->start = start;
+    e->length = length;
+    e->sig = sig;
+    snprintf(e->info, INFO, "%s", info);
+    return 1;
+}
+
+static void carve_one(size_t job, void* ctx)
+{
+    struct carve_job* j = ctx;
+    const unsigned char* p = j->p;
+    size_t n = j->n;
+    size_t cs = job * CHUNK;
+    size_t ce = (n - cs > CHUNK) ? cs + CHUNK : n;
+    if(ce > n - 1) ce = n - 1;  // every magic is at least 2 bytes
+
+    for(size_t i = cs; i < ce; ++i) {
+        unsigned k = p[i] | (p[i + 1] << 8);
+        if(!(first2[k >> 3] & (1u << (k & 7)))) continue;
+        for(int si = head[k]; si >= 0; si = next[si]) {
+            const struct signature* sig = &sigs[si];
+            if(n - i < sig->n || i < sig->offset) continue;
+            if(memcmp(p + i, sig->magic, sig->n) != 0) continue;
+
+            size_t start = i - sig->offset, length = 0;
+            char info[INFO];
+            snprintf(info, INFO, "%s", sig->name);
+            if(sig->parse && !sig->parse(p, n, &start, &length, info)) continue;
+            if(!push(&j->out[job], start, length, si, info)) j->failed = 1;
+        }
+    }
+}
+
+static int by_start(const void* a, const void* b)
+{
+    const struct hit* s = a;
+    const struct hit* t = b;
+    if(s->start != t->start) return (s->start < t->start) ? -1 : 1;
+    return s->sig - t->sig;
+}
+
+/** carve_scan
+  *
+  * Finds everything which looks like an embedded file in p[n], ordered by
+  * where they start. Returns NULL if we ran out of memory. Free the
+  * result with carve_free().
+  */
+void*
+carve_scan(const unsigned char* p, size_t n)
+{
+    if(!init_signatures() || !build_table()) return NULL;
+    struct hits* h = calloc(1, sizeof(struct hits));
+    if(!h || n < 2) return h;
+
+    size_t njobs = (n + CHUNK - 1) / CHUNK;
+    struct carve_job j = { p, n, calloc(njobs, sizeof(struct hits)), 0 };
+    if(!j.out) {
+        free(h);
+        return NULL;
+    }
+    run_parallel(njobs, carve_one, &j);
+
+    for(size_t k = 0; k < njobs; ++k) {
+        for(size_t i = 0; i < j.out[k].n && !j.failed; ++i) {
+            struct hit* e = &j.out[k].v[i];
+            if(!push(h, e->start, e->length, e->sig, e->info)) j.failed = 1;
+        }
+        free(j.out[k].v);
+    }
+    free(j.out);
+    if(j.failed) {
+        free(h->v);
+        free(h);
+        return NULL;
+    }
+    // some magic numbers aren't at the start of their file
+    qsort(h->v, h->n, sizeof(struct hit), by_start);
+    return h;
+}
+
+/** carve_count
+  *
+  * Returns how many embedded files carve_scan() found.
+  */
+size_t
+carve_count(void* vh)
+{
+    return ((struct hits*)vh)->n;
+}
+
+/** carve_get
+  *
+  * Returns where embedded file i starts, how long it is (0 if that's not
+  * known) and a description, e.g. "PNG image, 640x480".
+  */
+void
+carve_get(void* vh, size_t i, size_t* start, size_t* length, const char** info)
+{
+    struct hit* e = &((struct hits*)vh)->v[i];
+    *start = e->start;
+    *length = e->length;
+    *info = e->info;
+}
+
+/** carve_free
+  *
+  * Frees the result of carve_scan(). NULL is fine.
+  */
+void
+carve_free(void* vh)
+{
+    struct hits* h = vh;
+    if(!h) return;
+    free(h->v);
+    free(h);
+}
@@ -0,0 +1,248 @@
+/*
+Copyright 2024 Vlad Mesco
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+// Keeps track of which byte of the other file goes with which byte of the
+// buffer in diff mode, when bytes were inserted or deleted on either side.
+//
+// The sync table is a sorted list of (offset, delta) pairs: from offset
+// on, byte i of the buffer goes with byte i + delta of the other file. It
+// starts out as (0, 0). When comparing hits a difference which doesn't
+// go away within a window, the buffer is searched for the first block
+// which shows up in the other file near where it should be, via a table
+// of rolling hashes of the other file around there, and the pair for
+// that block goes in the table.
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+extern size_t
+scan_cmp(const unsigned char*, const unsigned char*, size_t);
+
+#define BLOCK 32                // bytes which need to match to resync
+#define WINDOW (64 * 1024)      // how far from the difference we look
+#define HASHBITS 18             // 2 * WINDOW slots
+#define PRIME 0x100000001B3ull  // FNV's; anything odd and big will do
+
+struct sync {
+    size_t offset;
+    long delta;
+};
+
+struct sync_table {
+    struct sync* v;
+    size_t n, cap;
+    uint32_t* slots;            // 1 + offset into the window, 0 is empty
+    uint64_t* hashes;
+};
+
+/** sync_new
+  *
+  * Returns a sync table which pairs every byte with the same offset in
+  * the other file, or NULL if we ran out of memory.
+  */
+void*
+sync_new(void)
+{
+    struct sync_table* t = calloc(1, sizeof(struct sync_table));
+    if(!t) return NULL;
+    t->v = malloc(16 * sizeof(struct sync));
+    if(!t->v) {
+        free(t);
+        return NULL;
+    }
+    t->cap = 16;
+    t->n = 1;
+    t->v[0].offset = 0;
+    t->v[0].delta = 0;
+    return t;
+}
+
+/** sync_reset
+  *
+  * Forgets everything learned, e.g. after bytes were inserted or deleted
+  * in the buffer.
+  */
+void
+sync_reset(void* vt)
+{
+    struct sync_table* t = vt;
+    t->n = 1;
+    t->v[0].offset = 0;
+    t->v[0].delta = 0;
+}
+
+/** sync_free
+  *
+  * Frees a sync table. NULL is fine.
+  */
+void
+sync_free(void* vt)
+{
+    struct sync_table* t = vt;
+    if(!t) return;
+    free(t->v);
+    free(t->slots);
+    free(t->hashes);
+    free(t);
+}
+
+// index of the last pair with offset <= i
+static size_t find(struct sync_table* t, size_t i)
+{
+    size_t lo = 0, hi = t->n - 1;
+    while(lo < hi) {
+        size_t mid = hi - (hi - lo) / 2;
+        if(t->v[mid].offset <= i) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+/** sync_delta
+  *
+  * Returns delta such that byte i of the buffer goes with byte i + delta
+  * of the other file. If they're not NULL, sets *from to where that
+  * started, and *until to the first offset past i where that changes, or
+  * SIZE_MAX.
+  */
+long
+sync_delta(void* vt, size_t i, size_t* from, size_t* until)
+{
+    struct sync_table* t = vt;
+    size_t k = find(t, i);
+    if(from) *from = t->v[k].offset;
+    if(until) *until = (k + 1 < t->n) ? t->v[k + 1].offset : SIZE_MAX;
+    return t->v[k].delta;
+}
+
+static uint64_t hash_block(const unsigned char* p)
+{
+    uint64_t h = 0;
+    for(int i = 0; i < BLOCK; ++i) h = h * PRIME + p[i];
+    return h;
+}
+
+// from offset on, pair with delta; the pairs which were between offset
+// and `upto' are dropped, being guesses made without knowing about this
+static int insert(struct sync_table* t, size_t offset, long delta, size_t upto)
+{
+    size_t k = find(t, offset);
+    size_t drop = k + 1;
+    while(drop < t->n && t->v[drop].offset <= upto) ++drop;
+    if(t->v[k].offset == offset) {
+        t->v[k].delta = delta;
+        memmove(t->v + k + 1, t->v + drop, (t->n - drop) * sizeof(struct sync));
+        t->n -= drop - k - 1;
+        return 1;
+    }
+    if(t->n + 1 > t->cap) {
+        void* v = realloc(t->v, 2 * t->cap * sizeof(struct sync));
+        if(!v) return 0;
+        t->v = v;
+        t->cap *= 2;
+    }
+    memmove(t->v + k + 2, t->v + drop, (t->n - drop) * sizeof(struct sync));
+    t->n -= drop - k - 1;
+    t->v[k + 1].offset = offset;
+    t->v[k + 1].delta = delta;
+    t->n++;
+    return 1;
+}
+
+/** sync_resync
+  *
+  * a[na] (the buffer) and b[nb] (the other file) differ at a[d]. If they
+  * line up again within a window with the same delta, that was a change
+  * and nothing happens. Otherwise, looks for the first block of a after
+  * d which is in b near where it should be and records the new delta
+  * from there on. Returns the offset into a where things line up again,
+  * or na if they don't as far as we looked.
+  */
+size_t
+sync_resync(void* vt, const unsigned char* a, size_t na,
+        const unsigned char* b, size_t nb, size_t d)
+{
+    struct sync_table* t = vt;
+    long delta = sync_delta(t, d, NULL, NULL);
+    size_t end = (na - d > WINDOW) ? d + WINDOW : na;
+
+    // lined up again with the same delta?
+    size_t same = na;
+    for(size_t i = d; i + BLOCK <= end; ) {
+        long j = (long)i + delta;
+        if(j < 0 || (size_t)j >= nb) break;
+        size_t n = nb - (size_t)j;
+        if(n > end - i) n = end - i;
+        size_t k = scan_cmp(a + i, b + j, n);
+        if(k >= BLOCK) {
+            same = i;
+            break;
+        }
+        i += k + 1;
+    }
+
+    // hash every block of b around d + delta
+    long center = (long)d + delta;
+    long wlo = center - WINDOW, whi = center + WINDOW;
+    if(wlo < 0) wlo = 0;
+    if(whi > (long)nb - BLOCK) whi = (long)nb - BLOCK;
+    if(whi < wlo) return same;
+    if(!t->slots) {
+        t->slots = malloc(sizeof(uint32_t) << HASHBITS);
+        t->hashes = malloc(sizeof(uint64_t) << HASHBITS);
+        if(!t->slots || !t->hashes) return same;
+    }
+    memset(t->slots, 0, sizeof(uint32_t) << HASHBITS);
+    const size_t mask = ((size_t)1 << HASHBITS) - 1;
+    uint64_t top = 1;   // PRIME^(BLOCK-1), to take the first byte out
+    for(int i = 1; i < BLOCK; ++i) top *= PRIME;
+
+    uint64_t h = hash_block(b + wlo);
+    for(long q = wlo; ; ++q) {
+        size_t s = (h >> (64 - HASHBITS)) & mask;
+        // keep the first of equal blocks; probing stops at the first hit
+        while(t->slots[s] && t->hashes[s] != h) s = (s + 1) & mask;
+        if(!t->slots[s]) {
+            t->slots[s] = (uint32_t)(q - wlo + 1);
+            t->hashes[s] = h;
+        }
+        if(q >= whi) break;
+        h = (h - b[q] * top) * PRIME + b[q + BLOCK];
+    }
+
+    // the first block of a after d which is in there, with another delta
+    // a block has to fit in a from wherever it starts
+    if(na < BLOCK || d + BLOCK > na) return same;
+    size_t stop = (same < end) ? same : end;
+    if(stop > na - BLOCK + 1) stop = na - BLOCK + 1;
+    if(d >= stop) return same;
+    h = hash_block(a + d);
+    for(size_t r = d; ; ++r) {
+        size_t s = (h >> (64 - HASHBITS)) & mask;
+        while(t->slots[s]) {
+            if(t->hashes[s] == h) {
+                long q = wlo + (long)t->slots[s] - 1;
+                if(q - (long)r != delta && memcmp(a + r, b + q, BLOCK) == 0) {
+                    if(!insert(t, r, q - (long)r, r + WINDOW)) return same;
+                    return r;
+                }
+                break;
+            }
+            s = (s + 1) & mask;
+        }
+        if(r + 1 >= stop) break;
+        h = (h - a[r] * top) * PRIME + a[r + BLOCK];
+    }
+    return same;
+}
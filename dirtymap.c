@@ -0,0 +1,324 @@
+/*
+Copyright 2024 Vlad Mesco
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+// Which bytes of the buffer were modified, as a bitmap with one bit per
+// byte, plus summary levels on top of it: bit j of level k + 1 is set if
+// word j of level k has any bits set. Finding the next or previous set
+// bit looks at one word per level going up and one per level coming back
+// down, so it's O(log n) however far away that is.
+//
+// The bitmap is allocated zeroed, so the OS only hands out pages for the
+// parts of a big file which have actually been touched.
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define MAXLEVELS 12    // 64^11 bits ought to be enough
+
+struct dirtymap {
+    size_t n;                   // bits in level 0
+    int nlevels;
+    uint64_t* level[MAXLEVELS];
+    size_t nwords[MAXLEVELS];
+    size_t capacity;            // of level 0, in words
+};
+
+static int ctz64(uint64_t x)
+{
+#ifdef __GNUC__
+    return __builtin_ctzll(x);
+#else
+    int n = 0;
+    while(!(x & 1)) {
+        x >>= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
+
+static int top64(uint64_t x)
+{
+#ifdef __GNUC__
+    return 63 - __builtin_clzll(x);
+#else
+    int n = 63;
+    while(!(x >> n)) --n;
+    return n;
+#endif
+}
+
+// bits [0, k) of a word; k may be 64
+static uint64_t below(size_t k)
+{
+    return (k >= 64) ? ~0ull : ((1ull << k) - 1);
+}
+
+// recomputes the summary levels from level 0 word w0 on, reallocating
+// them if the bitmap changed size. Returns 0 if we ran out of memory
+static int summarize(struct dirtymap* d, size_t w0)
+{
+    int k = 0;
+    size_t nwords = d->nwords[0];
+    while(nwords > 1) {
+        size_t up = (nwords + 63) / 64;
+        if(k + 1 >= MAXLEVELS) return 0;
+        // a level we weren't keeping up to date is redone from scratch
+        if(k + 1 >= d->nlevels) w0 = 0;
+        if(up != d->nwords[k + 1] || !d->level[k + 1]) {
+            uint64_t* v = realloc(d->level[k + 1], up * sizeof(uint64_t));
+            if(!v) return 0;
+            d->level[k + 1] = v;
+            d->nwords[k + 1] = up;
+        }
+        // from the word holding the bit for w0 on
+        size_t u0 = w0 / 64;
+        for(size_t u = u0; u < up; ++u) {
+            uint64_t bits = 0;
+            for(size_t j = 0; j < 64 && u * 64 + j < nwords; ++j) {
+                bits |= (uint64_t)(d->level[k][u * 64 + j] != 0) << j;
+            }
+            d->level[k + 1][u] = bits;
+        }
+        w0 = u0;
+        nwords = up;
+        ++k;
+    }
+    d->nlevels = k + 1;
+    return 1;
+}
+
+/** dirty_free
+  *
+  * Frees a map. NULL is fine.
+  */
+void
+dirty_free(void* vd)
+{
+    struct dirtymap* d = vd;
+    if(!d) return;
+    for(int k = 0; k < MAXLEVELS; ++k) free(d->level[k]);
+    free(d);
+}
+
+/** dirty_new
+  *
+  * Returns a map of n bytes none of which are modified, or NULL if we ran
+  * out of memory. Free it with dirty_free().
+  */
+void*
+dirty_new(size_t n)
+{
+    struct dirtymap* d = calloc(1, sizeof(struct dirtymap));
+    if(!d) return NULL;
+    d->n = n;
+    d->nlevels = 1;
+    d->nwords[0] = (n + 63) / 64;
+    d->capacity = d->nwords[0] ? d->nwords[0] : 1;
+    d->level[0] = calloc(d->capacity, sizeof(uint64_t));
+    if(!d->level[0] || !summarize(d, 0)) {
+        dirty_free(d);
+        return NULL;
+    }
+    return d;
+}
+
+/** dirty_mark
+  *
+  * Marks bytes [a1, a2) as modified.
+  */
+void
+dirty_mark(void* vd, size_t a1, size_t a2)
+{
+    struct dirtymap* d = vd;
+    if(a2 > d->n) a2 = d->n;
+    // set bits [a1, a2) at every level, the range shrinking 64 times
+    // each level up
+    for(int k = 0; k < d->nlevels && a1 < a2; ++k) {
+        uint64_t* v = d->level[k];
+        size_t w1 = a1 / 64, w2 = (a2 - 1) / 64;
+        if(w1 == w2) {
+            v[w1] |= below(a2 - w1 * 64) & ~below(a1 - w1 * 64);
+        } else {
+            v[w1] |= ~below(a1 - w1 * 64);
+            for(size_t w = w1 + 1; w < w2; ++w) v[w] = ~0ull;
+            v[w2] |= below(a2 - w2 * 64);
+        }
+        a1 = w1;
+        a2 = w2 + 1;
+    }
+}
+
+/** dirty_test
+  *
+  * Returns nonzero if byte i was modified.
+  */
+int
+dirty_test(void* vd, size_t i)
+{
+    struct dirtymap* d = vd;
+    return i < d->n && ((d->level[0][i / 64] >> (i % 64)) & 1);
+}
+
+/** dirty_next
+  *
+  * Returns the first modified byte at or after i, or SIZE_MAX.
+  */
+size_t
+dirty_next(void* vd, size_t i)
+{
+    struct dirtymap* d = vd;
+    size_t pos = i;
+    for(int k = 0; k < d->nlevels; ++k) {
+        size_t w = pos / 64;
+        if(w >= d->nwords[k]) return SIZE_MAX;
+        uint64_t m = d->level[k][w] & ~below(pos % 64);
+        if(m) {
+            pos = w * 64 + ctz64(m);
+            // back down, taking the first set bit of every word
+            for(int j = k; j > 0; --j) pos = pos * 64 + ctz64(d->level[j - 1][pos]);
+            return (pos < d->n) ? pos : SIZE_MAX;
+        }
+        pos = w + 1;
+    }
+    return SIZE_MAX;
+}
+
+/** dirty_prev
+  *
+  * Returns the last modified byte before i, or SIZE_MAX.
+  */
+size_t
+dirty_prev(void* vd, size_t i)
+{
+    struct dirtymap* d = vd;
+    if(i == 0 || d->n == 0) return SIZE_MAX;
+    size_t pos = (i > d->n) ? d->n - 1 : i - 1;
+    for(int k = 0; k < d->nlevels; ++k) {
+        size_t w = pos / 64;
+        uint64_t m = d->level[k][w] & below(pos % 64 + 1);
+        if(m) {
+            pos = w * 64 + top64(m);
+            for(int j = k; j > 0; --j) pos = pos * 64 + top64(d->level[j - 1][pos]);
+            return pos;
+        }
+        if(w == 0) return SIZE_MAX;
+        pos = w - 1;
+    }
+    return SIZE_MAX;
+}
+
+/** dirty_next_clean
+  *
+  * Returns the first byte at or after i which wasn't modified, or the size
+  * of the map if there's none. This goes a word at a time, so it costs
+  * the length of the modified stretch over 64.
+  */
+size_t
+dirty_next_clean(void* vd, size_t i)
+{
+    struct dirtymap* d = vd;
+    if(i >= d->n) return d->n;
+    size_t w = i / 64;
+    uint64_t m = ~d->level[0][w] & ~below(i % 64);
+    while(!m) {
+        if(++w >= d->nwords[0]) return d->n;
+        m = ~d->level[0][w];
+    }
+    size_t pos = w * 64 + ctz64(m);
+    return (pos < d->n) ? pos : d->n;
+}
+
+// level 0 bits [pos, pos + 64); positions outside the map read as 0
+static uint64_t get64(const struct dirtymap* d, long long pos)
+{
+    const uint64_t* v = d->level[0];
+    if(pos <= -64) return 0;
+    if(pos < 0) return (d->nwords[0] ? v[0] : 0) << (-pos);
+    size_t w = (size_t)pos / 64;
+    int s = (int)((size_t)pos % 64);
+    uint64_t lo = (w < d->nwords[0]) ? v[w] >> s : 0;
+    uint64_t hi = (s && w + 1 < d->nwords[0]) ? v[w + 1] << (64 - s) : 0;
+    return lo | hi;
+}
+
+/** dirty_insert
+  *
+  * count bytes were inserted before byte at; the bits from there on move
+  * up. The new bytes aren't marked, that's up to the caller. Returns 0 if
+  * we ran out of memory, and the map is garbage then.
+  */
+int
+dirty_insert(void* vd, size_t at, size_t count)
+{
+    struct dirtymap* d = vd;
+    if(at > d->n) at = d->n;
+    size_t nwords = (d->n + count + 63) / 64;
+    if(nwords > d->capacity) {
+        size_t cap = d->capacity * 2;
+        if(cap < nwords) cap = nwords;
+        uint64_t* v = realloc(d->level[0], cap * sizeof(uint64_t));
+        if(!v) return 0;
+        memset(v + d->capacity, 0, (cap - d->capacity) * sizeof(uint64_t));
+        d->level[0] = v;
+        d->capacity = cap;
+    }
+    size_t oldwords = d->nwords[0];
+    d->nwords[0] = nwords;
+
+    // top down, so every word is read before it gets written
+    size_t end = at + count;
+    for(size_t w = nwords; w-- > at / 64; ) {
+        long long base = (long long)w * 64;
+        uint64_t keep = 0, moved;
+        if((size_t)base < at) {
+            keep = (w < oldwords ? d->level[0][w] : 0) & below(at - base);
+        }
+        moved = get64(d, base - (long long)count);
+        if((size_t)base < end) moved &= ~below(end - base);
+        d->level[0][w] = keep | moved;
+    }
+    d->n += count;
+    return summarize(d, at / 64);
+}
+
+/** dirty_delete
+  *
+  * Bytes [at, at + count) were deleted; the bits after them move down.
+  */
+void
+dirty_delete(void* vd, size_t at, size_t count)
+{
+    struct dirtymap* d = vd;
+    if(at >= d->n) return;
+    if(count > d->n - at) count = d->n - at;
+    size_t nwords = (d->n - count + 63) / 64;
+
+    // bottom up, so every word is read before it gets written
+    for(size_t w = at / 64; w < d->nwords[0]; ++w) {
+        size_t base = w * 64;
+        uint64_t keep = 0;
+        if(base < at) keep = d->level[0][w] & below(at - base);
+        uint64_t moved = get64(d, (long long)(base + count));
+        if(base < at) moved &= ~below(at - base);
+        d->level[0][w] = keep | moved;
+    }
+    // no stray bits past the end
+    d->n -= count;
+    if(d->n % 64 && nwords) d->level[0][nwords - 1] &= below(d->n % 64);
+    for(size_t w = nwords; w < d->nwords[0]; ++w) d->level[0][w] = 0;
+    d->nwords[0] = nwords;
+    // shrinking never needs memory
+    summarize(d, at / 64);
+}
@@ -0,0 +1,391 @@
+/*
+Copyright 2024 Vlad Mesco
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+// Checksums and hashes of a range of bytes: CRC-32 (the zlib/PNG one),
+// CRC-32C (Castagnoli, the iSCSI/ext4/btrfs one), xxHash64 and SHA-256,
+// giving the same answers as crc32(1), xxhsum(1) and sha256sum(1).
+//
+// The CRCs are done slicing-by-8, and with the SSE4.2 crc32 instruction
+// for CRC-32C if the CPU has it. Big ranges are cut into chunks
+// which are checksummed in parallel and stitched together afterwards,
+// the way zlib's crc32_combine() does it. xxHash64 and SHA-256 can't be
+// split up like that without giving a different answer, so they run on
+// one thread; SHA-256 uses the SHA extensions if the CPU has them. Both
+// are picked at run time, so a plain -O2 build gets them too.
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+# define X86_64 1
+# include <immintrin.h>
+#endif
+
+extern void
+run_parallel(size_t, void (*)(size_t, void*), void*);
+
+#define CHUNK (4u << 20)
+#define CRC32_POLY 0xEDB88320u  // reflected
+#define CRC32C_POLY 0x82F63B78u
+
+struct crc {
+    uint32_t poly;
+    uint32_t table[8][256];
+    uint32_t x2n[32];           // x^(2^k) mod poly
+    int ready;
+};
+
+static struct crc crc32 = { .poly = CRC32_POLY };
+static struct crc crc32c = { .poly = CRC32C_POLY };
+
+// a * b mod poly, bit reflected
+static uint32_t multmodp(const struct crc* c, uint32_t a, uint32_t b)
+{
+    uint32_t m = 1u << 31, p = 0;
+    for(;;) {
+        if(a & m) {
+            p ^= b;
+            if((a & (m - 1)) == 0) break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ c->poly : b >> 1;
+    }
+    return p;
+}
+
+// called on the main thread before anything runs in parallel
+static void crc_init(struct crc* c)
+{
+    if(c->ready) return;
+    for(uint32_t i = 0; i < 256; ++i) {
+        uint32_t r = i;
+        for(int k = 0; k < 8; ++k) r = (r & 1) ? (r >> 1) ^ c->poly : r >> 1;
+        c->table[0][i] = r;
+    }
+    for(int k = 1; k < 8; ++k) {
+        for(int i = 0; i < 256; ++i) {
+            uint32_t r = c->table[k - 1][i];
+            c->table[k][i] = (r >> 8) ^ c->table[0][r & 0xFF];
+        }
+    }
+    uint32_t p = 1u << 30;      // x^1
+    c->x2n[0] = p;
+    for(int k = 1; k < 32; ++k) c->x2n[k] = p = multmodp(c, p, p);
+    c->ready = 1;
+}
+
+static uint32_t load32(const unsigned char* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8)
+        | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t load64(const unsigned char* p)
+{
+    return (uint64_t)load32(p) | ((uint64_t)load32(p + 4) << 32);
+}
+
+#ifdef X86_64
+// crc_update() for CRC-32C, with the crc32 instruction
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t r, const unsigned char* p, size_t n)
+{
+    uint64_t r64 = r;
+    for(; n >= 8; p += 8, n -= 8) r64 = _mm_crc32_u64(r64, load64(p));
+    r = (uint32_t)r64;
+    for(; n; ++p, --n) r = _mm_crc32_u8(r, *p);
+    return r;
+}
+#endif
+
+// the raw CRC register over n bytes, without the pre and post inversion
+static uint32_t crc_update(const struct crc* c, uint32_t r,
+        const unsigned char* p, size_t n)
+{
+#ifdef X86_64
+    if(c->poly == CRC32C_POLY && __builtin_cpu_supports("sse4.2"))
+        return crc32c_sse42(r, p, n);
+#endif
+    const uint32_t (*t)[256] = c->table;
+    for(; n >= 8; p += 8, n -= 8) {
+        uint32_t one = load32(p) ^ r;
+        uint32_t two = load32(p + 4);
+        r = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF]
+            ^ t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24]
+            ^ t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF]
+            ^ t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+    }
+    for(; n; ++p, --n) r = (r >> 8) ^ t[0][(r ^ *p) & 0xFF];
+    return r;
+}
+
+// the CRC of A followed by B, from the CRCs of A and B and B's length
+static uint32_t crc_combine(const struct crc* c,
+        uint32_t crca, uint32_t crcb, size_t nb)
+{
+    // x^(8 nb) mod poly
+    uint32_t x = 1u << 31;
+    uint64_t bits = (uint64_t)nb;
+    for(int k = 3; bits; bits >>= 1, ++k) {
+        if(bits & 1) x = multmodp(c, c->x2n[k & 31], x);
+    }
+    return multmodp(c, x, crca) ^ crcb;
+}
+
+struct crc_job {
+    const struct crc* c;
+    const unsigned char* p;
+    size_t n;
+    uint32_t* crcs;         // one per chunk
+};
+
+static void crc_chunk(size_t i, void* ctx)
+{
+    struct crc_job* job = ctx;
+    size_t from = i * CHUNK;
+    size_t n = (job->n - from < CHUNK) ? job->n - from : CHUNK;
+    job->crcs[i] = ~crc_update(job->c, 0xFFFFFFFFu, job->p + from, n);
+}
+
+static uint32_t crc_parallel(struct crc* c, const unsigned char* p, size_t n)
+{
+    crc_init(c);
+    size_t nchunks = (n + CHUNK - 1) / CHUNK;
+    uint32_t* crcs = (nchunks > 1) ? malloc(nchunks * sizeof(uint32_t)) : NULL;
+    if(!crcs) return ~crc_update(c, 0xFFFFFFFFu, p, n);
+
+    struct crc_job job = { c, p, n, crcs };
+    run_parallel(nchunks, crc_chunk, &job);
+    uint32_t r = crcs[0];
+    for(size_t i = 1; i < nchunks; ++i) {
+        size_t len = (n - i * CHUNK < CHUNK) ? n - i * CHUNK : CHUNK;
+        r = crc_combine(c, r, crcs[i], len);
+    }
+    free(crcs);
+    return r;
+}
+
+/** hash_crc32
+  *
+  * Returns the CRC-32 of p[0, n), as in zlib, PNG, gzip and zip.
+  */
+uint32_t
+hash_crc32(const unsigned char* p, size_t n)
+{
+    return crc_parallel(&crc32, p, n);
+}
+
+/** hash_crc32c
+  *
+  * Returns the CRC-32C (Castagnoli) of p[0, n).
+  */
+uint32_t
+hash_crc32c(const unsigned char* p, size_t n)
+{
+    return crc_parallel(&crc32c, p, n);
+}
+
+#define P1 11400714785074694791ull
+#define P2 14029467366897019727ull
+#define P3 1609587929392839161ull
+#define P4 9650029242287828579ull
+#define P5 2870177450012600261ull
+
+static uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t xxh_round(uint64_t acc, uint64_t input)
+{
+    acc += input * P2;
+    acc = rotl64(acc, 31);
+    return acc * P1;
+}
+
+static uint64_t xxh_merge(uint64_t acc, uint64_t v)
+{
+    acc ^= xxh_round(0, v);
+    return acc * P1 + P4;
+}
+
+/** hash_xxh64
+  *
+  * Returns the xxHash64 of p[0, n) with seed 0.
+  */
+uint64_t
+hash_xxh64(const unsigned char* p, size_t n)
+{
+    uint64_t h;
+    size_t len = n;
+    if(n >= 32) {
+        uint64_t v1 = P1 + P2, v2 = P2, v3 = 0, v4 = -P1;
+        for(; n >= 32; p += 32, n -= 32) {
+            v1 = xxh_round(v1, load64(p));
+            v2 = xxh_round(v2, load64(p + 8));
+            v3 = xxh_round(v3, load64(p + 16));
+            v4 = xxh_round(v4, load64(p + 24));
+        }
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    } else {
+        h = P5;
+    }
+    h += (uint64_t)len;
+    for(; n >= 8; p += 8, n -= 8) {
+        h ^= xxh_round(0, load64(p));
+        h = rotl64(h, 27) * P1 + P4;
+    }
+    if(n >= 4) {
+        h ^= (uint64_t)load32(p) * P1;
+        h = rotl64(h, 23) * P2 + P3;
+        p += 4;
+        n -= 4;
+    }
+    for(; n; ++p, --n) {
+        h ^= *p * P5;
+        h = rotl64(h, 11) * P1;
+    }
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#ifdef X86_64
+// sha256_blocks() with the SHA extensions
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_ni(uint32_t s[8], const unsigned char* p, size_t nblocks)
+{
+    const __m128i BSWAP = _mm_set_epi64x(0x0c0d0e0f08090a0bll, 0x0405060700010203ll);
+    // the state as the instructions want it, ABEF and CDGH
+    __m128i t = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&s[0]), 0xB1);
+    __m128i s1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&s[4]), 0x1B);
+    __m128i s0 = _mm_alignr_epi8(t, s1, 8);
+    s1 = _mm_blend_epi16(s1, t, 0xF0);
+
+    for(; nblocks; --nblocks, p += 64) {
+        __m128i abef = s0, cdgh = s1;
+        __m128i w[4];
+        for(int i = 0; i < 16; ++i) {
+            if(i < 4) {
+                w[i] = _mm_shuffle_epi8(
+                        _mm_loadu_si128((const __m128i*)(p + 16 * i)), BSWAP);
+            } else {
+                __m128i m = _mm_sha256msg1_epu32(w[i % 4], w[(i + 1) % 4]);
+                m = _mm_add_epi32(m, _mm_alignr_epi8(w[(i + 3) % 4], w[(i + 2) % 4], 4));
+                w[i % 4] = _mm_sha256msg2_epu32(m, w[(i + 3) % 4]);
+            }
+            __m128i m = _mm_add_epi32(w[i % 4], _mm_loadu_si128((const __m128i*)&K[4 * i]));
+            s1 = _mm_sha256rnds2_epu32(s1, s0, m);
+            s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(m, 0x0E));
+        }
+        s0 = _mm_add_epi32(s0, abef);
+        s1 = _mm_add_epi32(s1, cdgh);
+    }
+
+    t = _mm_shuffle_epi32(s0, 0x1B);
+    s1 = _mm_shuffle_epi32(s1, 0xB1);
+    _mm_storeu_si128((__m128i*)&s[0], _mm_blend_epi16(t, s1, 0xF0));
+    _mm_storeu_si128((__m128i*)&s[4], _mm_alignr_epi8(s1, t, 8));
+}
+#endif
+
+#define ROR(x, r) (((x) >> (r)) | ((x) << (32 - (r))))
+
+static void sha256_blocks(uint32_t s[8], const unsigned char* p, size_t nblocks)
+{
+#ifdef X86_64
+    if(__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1")) {
+        sha256_blocks_ni(s, p, nblocks);
+        return;
+    }
+#endif
+    for(; nblocks; --nblocks, p += 64) {
+        uint32_t w[64];
+        for(int i = 0; i < 16; ++i) {
+            w[i] = ((uint32_t)p[4 * i] << 24) | ((uint32_t)p[4 * i + 1] << 16)
+                | ((uint32_t)p[4 * i + 2] << 8) | p[4 * i + 3];
+        }
+        for(int i = 16; i < 64; ++i) {
+            uint32_t s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = s[0], b = s[1], c = s[2], d = s[3];
+        uint32_t e = s[4], f = s[5], g = s[6], h = s[7];
+        for(int i = 0; i < 64; ++i) {
+            uint32_t t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25))
+                + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            uint32_t t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22))
+                + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+        s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+    }
+}
+
+/** hash_sha256
+  *
+  * Writes the SHA-256 of p[0, n) to digest.
+  */
+void
+hash_sha256(const unsigned char* p, size_t n, unsigned char digest[32])
+{
+    uint32_t s[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    sha256_blocks(s, p, n / 64);
+
+    // the padding: 0x80, zeros, and the length in bits, big endian
+    unsigned char tail[128] = { 0 };
+    size_t rest = n % 64;
+    memcpy(tail, p + n - rest, rest);
+    tail[rest] = 0x80;
+    size_t ntail = (rest < 56) ? 64 : 128;
+    uint64_t bits = (uint64_t)n * 8;
+    for(int i = 0; i < 8; ++i) tail[ntail - 1 - i] = (unsigned char)(bits >> (8 * i));
+    sha256_blocks(s, tail, ntail / 64);
+
+    for(int i = 0; i < 8; ++i) {
+        digest[4 * i] = (unsigned char)(s[i] >> 24);
+        digest[4 * i + 1] = (unsigned char)(s[i] >> 16);
+        digest[4 * i + 2] = (unsigned char)(s[i] >> 8);
+        digest[4 * i + 3] = (unsigned char)s[i];
+    }
+}
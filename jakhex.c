@@ -11,7 +11,7 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
 */
 // NOLINTBEGIN
 #ifndef _XOPEN_SOURCE
-# define _XOPEN_SOURCE 500
+# define _XOPEN_SOURCE 700
 #endif
 // NOLINTEND
 
@@ -20,12 +20,16 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
 #include <string.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <time.h>
 
 #include <unistd.h>
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include <curses.h>
 
@@ -58,6 +62,178 @@ extern void*
 bpatmemsearch(void*, size_t, void*, size_t, void*);
 extern void*
 bpatrmemsearch(void*, size_t, void*, size_t, void*);
+extern void*
+memsearch_begin(void*, size_t);
+extern void*
+rmemsearch_begin(void*, size_t);
+extern void*
+bpatmemsearch_begin(void*, size_t, void*);
+extern void*
+bpatrmemsearch_begin(void*, size_t, void*);
+extern void*
+memsearch_feed(void*, void*, size_t, size_t*);
+extern void
+memsearch_reset(void*);
+extern void
+memsearch_end(void*);
+
+extern void
+stats_record(int, unsigned long);
+extern unsigned long
+stats_count(int);
+extern unsigned long
+stats_last(int);
+extern unsigned long
+stats_percentile(int, double);
+extern char*
+stats_format(unsigned long, char*, size_t);
+extern void
+stats_dump(FILE*, const char* (*)(int));
+
+extern int
+trace_open(size_t);
+extern int
+trace_enabled(void);
+extern void
+trace_event(char, const char*, unsigned long, const char*, unsigned long);
+extern int
+trace_write(const char*);
+
+extern void*
+summary_build(const unsigned char*, size_t);
+extern int
+summary_update(void*, const unsigned char*, size_t, size_t, size_t);
+extern void
+summary_free(void*);
+extern int
+summary_levels(void);
+extern size_t
+summary_block_size(int);
+extern size_t
+summary_blocks(void*, int);
+extern void
+summary_get(void*, int, size_t, double*, double*, double*);
+
+extern size_t
+scan_skip(const unsigned char*, size_t, unsigned char);
+extern size_t
+scan_rskip(const unsigned char*, size_t, unsigned char);
+extern void
+scan_runs(const unsigned char*, size_t, size_t,
+        int (*)(size_t, size_t, unsigned char, void*), void*);
+extern size_t
+scan_cmp(const unsigned char*, const unsigned char*, size_t);
+extern size_t
+scan_rcmp(const unsigned char*, const unsigned char*, size_t);
+
+extern void*
+sync_new(void);
+extern void
+sync_reset(void*);
+extern void
+sync_free(void*);
+extern long
+sync_delta(void*, size_t, size_t*, size_t*);
+extern size_t
+sync_resync(void*, const unsigned char*, size_t, const unsigned char*, size_t, size_t);
+
+extern size_t
+utf8_next_invalid(const unsigned char*, size_t, size_t, const char**);
+extern size_t
+utf8_prev_invalid(const unsigned char*, size_t, size_t, const char**);
+
+extern void*
+strings_find(const unsigned char*, size_t, size_t);
+extern size_t
+strings_count(void*);
+extern void
+strings_get(void*, size_t, size_t*, size_t*, int*);
+extern void
+strings_free(void*);
+
+extern int
+carve_add(const char*, size_t, const unsigned char*, size_t);
+extern void*
+carve_scan(const unsigned char*, size_t);
+extern size_t
+carve_count(void*);
+extern void
+carve_get(void*, size_t, size_t*, size_t*, const char**);
+extern void
+carve_free(void*);
+
+extern void*
+dirty_new(size_t);
+extern void
+dirty_free(void*);
+extern void
+dirty_mark(void*, size_t, size_t);
+extern int
+dirty_test(void*, size_t);
+extern size_t
+dirty_next(void*, size_t);
+extern size_t
+dirty_prev(void*, size_t);
+extern int
+dirty_insert(void*, size_t, size_t);
+extern void
+dirty_delete(void*, size_t, size_t);
+extern size_t
+dirty_next_clean(void*, size_t);
+
+extern uint32_t
+hash_crc32(const unsigned char*, size_t);
+extern uint32_t
+hash_crc32c(const unsigned char*, size_t);
+extern uint64_t
+hash_xxh64(const unsigned char*, size_t);
+extern void
+hash_sha256(const unsigned char*, size_t, unsigned char*);
+
+extern void*
+merkle_build(const unsigned char*, size_t);
+extern int
+merkle_update(void*, const unsigned char*, size_t, size_t, size_t);
+extern void*
+merkle_copy(void*);
+extern void
+merkle_free(void*);
+extern size_t
+merkle_block_size(void);
+extern size_t
+merkle_size(void*);
+extern size_t
+merkle_diff(void*, void*, void (*)(size_t, void*), void*);
+
+extern int
+transform(unsigned char*, size_t, size_t, char, const unsigned char*, size_t);
+
+extern uint64_t
+record_load(const unsigned char*, int, int);
+extern uint64_t
+record_key(const unsigned char*, int, int, char);
+extern uint64_t
+record_value(uint64_t, char);
+extern void
+record_format(uint64_t, int, char, char*, size_t);
+extern int
+records_stats(const unsigned char*, size_t, size_t, size_t, int, int, char,
+        size_t*, uint64_t*, uint64_t*, double*, size_t*);
+extern size_t
+records_sort(unsigned char*, size_t, size_t, size_t, int, int, char, char);
+extern int
+record_parse(const char*, int, char, uint64_t*);
+extern size_t
+records_bisect(const unsigned char*, size_t, size_t, size_t, int, int, char,
+        uint64_t, int*, int*);
+
+extern size_t
+period_find(const unsigned char*, size_t, size_t, size_t, size_t*, double*, double*);
+
+extern int
+ncpus(void);
+extern void
+run_parallel(size_t, void (*)(size_t, void*), void*);
 
 // buffer state
 unsigned char* mem = NULL;
@@ -75,15 +251,50 @@ unsigned char* searchString = NULL;
 unsigned char* searchStringMask = NULL;
 size_t nSearchString = 0;
 
+// instrumentation
+// commands are recorded under their key code, everything else under these
+enum STAT_SLOT {
+    STAT_REDRAW = KEY_MAX + 1,
+    STAT_REPAINT,
+    STAT_DETAILS,
+    STAT_MOTION,
+    STAT_SEARCH,
+    STAT_READ,
+    STAT_WRITE
+};
+struct probe {
+    int slot;
+    unsigned long start;
+    unsigned long waited;
+    unsigned long bytes;    // for the trace; set it before probe_end()
+};
+static unsigned long now_ns(void);
+static struct probe probe_begin(int slot);
+static void probe_end(struct probe p);
+static const char* slot_name(int slot);
+static void trace_key(int c);
+static int getkey(void);
+
 // exit function
 static void finish(void);
 static void showhelp(const char* argv0);
 
+// headless mode
+static int grep_files(const char* pattern, char** files, int nfiles);
+static void bench_redraw(void);
+
 // drawing functions
 static void redraw(void);
+static void repaint(void);
+static void adjust_window(void);
+static void draw_line(int i);
+static void draw_separator(void);
+static void mem_changed(size_t a1, size_t a2);
 static void adjust_screen(void);
 static void update_status(void);
 static void update_details(void);
+static void draw_details(void);
+static int view_lines(void);
 static void printbinle(int l, int c);
 static void printbinbe(int l, int c);
 static void printbin(int l, int c, unsigned long);
@@ -93,14 +304,29 @@ static void show_detailed_cursor(void);
 enum DIR {
     RIGHT, LEFT, DOWN, UP
 };
+static void step(int dir);
+static void page_step(int dir);
+static int apply_motion(int c);
 static void mymove(int dir);
-static void pagemove(int dir);
 static void goto_command(void);
 static void advance_offset(long sign);
+static void skip_run(int dir, int prompt);
+static void list_runs(void);
 static void set_marker(void);
 static void list_markers(void);
+static int browse_list(const char* title, size_t n,
+        void (*fmt)(size_t, char*, size_t, void*), void* ctx,
+        const char* keys, size_t* psel);
+static void overview(void);
+static void list_strings(void);
+static void carve_files(void);
+static void load_magic(const char* path);
 static void goto_marker(void);
 static void save_search_string(void* s, size_t len, void* mask);
+static int parse_search_string(
+        const char* s,
+        unsigned char** pneedle, size_t* pnneedle,
+        unsigned char** pmask);
 enum SEARCH_DIRECTION {
     FORWARDS,
     BACKWARDS
@@ -113,19 +339,52 @@ static void find_cb(
         enum SEARCH_DIRECTION direction);
 static void find_forward(int prompt);
 static void find_backward(int prompt);
+static void find_invalid_utf8(int dir);
+static void replace_all(void);
+static void copy_dirty(void* to, size_t dst, size_t src, size_t n);
+static void find_modified(int dir);
+
+// diff mode
+static void diff_open(void);
+static void diff_jump(int dir);
+static int differs(size_t i);
+
+// transactions
+static void transaction(void);
+static void tx_queue(int kind);
+static void tx_list(void);
+static void tx_commit(void);
+static void tx_clear(void);
 
 // region functions
+static int read_pair_of_markers(size_t* pa1, size_t* pa2);
 static void blank_region(void);
 static void kill_region(void);
 static void yank_region(void);
 static void write_region(void);
+static void write_range(size_t a1, size_t a2);
+static void hash_region(void);
+static void transform_region(void);
 static void paste_clipboard(size_t before);
 static void overwrite_clipboard(void);
 
+// records
+struct field;
+static int parse_fields(const char* s, size_t size, struct field** pf, size_t* pn);
+static void field_label(const struct field* f, char* buf, size_t nbuf);
+static size_t read_record_size(void);
+static int read_field(const char* what, size_t size, struct field* pf);
+static int read_layout(void);
+static void record_view(void);
+static void sort_records(void);
+static void bisect_records(void);
+static void find_period(void);
+
 // dialog functions
 static int question(const char* q);
 static char* read_string(const char* prompt);
 static char read_key(const char* prompt, const char* allowed);
+static int progress(const char* what, size_t done, size_t total);
 static char* read_filename(void);
 static void myhelp(void);
 
@@ -133,6 +392,9 @@ static void myhelp(void);
 static void punch(int c);
 static void overwrite_mem(void* mem, size_t nbytes);
 static void punch_interpreted(void);
+static size_t encode_value(char choice, const char* s, unsigned char out[8]);
+static void apply_to_hits(void);
+static void undo_apply(void);
 static void truncate_file(size_t at);
 static void insert_n_nulls(size_t before, size_t n);
 static void insert_nulls(size_t before);
@@ -141,9 +403,14 @@ static void insert_file(size_t before);
 static void new_file(void);
 static void test_file(void);
 static void save_file(void);
+static int write_changed_blocks(const char* path);
+static void file_saved(int fd);
+static int unchanged_since(const struct stat* sb);
 static void open_file(void);
 static void open_file1(void);
 static void open_file2(FILE** f, ssize_t* sz);
+static int merkle_sync(void);
+static void compare_blocks(void);
 
 // main loop handlers
 // handle_normal handles "normal" hex input and command mode
@@ -152,12 +419,116 @@ static void handle_normal(int c);
 static void handle_text(int c);
 void (*handle_keys)(int) = handle_normal;
 
+// the details pane is only drawn once the keyboard has been quiet for
+// this long, see update_details()
+#define DETAILS_IDLE_MS 50
+static int detailsHidden = 0;
+static int detailsStale = 0;
+
+// instrumentation state
+static int showOverlay = 0;                // show latencies on the separator
+static int dumpStats = 0;               // print histograms on exit
+static int lastCommand = -1;            // slot of the last command
+static unsigned long inputWaitNs = 0;   // time spent in getkey()
+static char* traceFile = NULL;          // --trace
+
+// rendering state; see repaint()
+static size_t paintedWindowOffset = 0;
+static int paintedLines = 0;    // 0 means nothing on screen can be trusted
+static size_t dirtyFrom = 0;    // buffer lines [dirtyFrom, dirtyTo) need
+static size_t dirtyTo = 0;      // to be repainted
+
+// overview state; the summary is built the first time it's needed and
+// bytes [summaryStaleFrom, summaryStaleTo) get redone the next time
+static void* summary = NULL;
+static size_t summaryStaleFrom = SIZE_MAX;
+static size_t summaryStaleTo = 0;
+
+// diff mode state; the other file is mapped read only, and diffSync says
+// which of its bytes goes with which byte of the buffer
+static void* diffSync = NULL;   // NULL if there's no diff going on
+static unsigned char* diffMem = NULL;
+static size_t diffSize = 0;
+static size_t diffLearned = 0;  // diffSync is good up to here
+
+// hash trees of the buffer as it is now, as it is on disk and as it was at
+// the checkpoint; bytes [merkleStaleFrom, merkleStaleTo) of the first one
+// need rehashing. diskStat says which file merkleDisk describes
+static void* merkle = NULL;
+static void* merkleDisk = NULL;
+static void* merkleCheckpoint = NULL;
+static size_t merkleStaleFrom = SIZE_MAX;
+static size_t merkleStaleTo = 0;
+static struct stat diskStat;
+
+// edits queued up with |, which all get applied at once; their offsets
+// are all in the buffer as it is before that, so they don't shift each other
+enum TX_KIND {
+    TX_INSERT,
+    TX_DELETE,
+    TX_OVERWRITE
+};
+struct txop {
+    int kind;
+    size_t offset;
+    size_t length;
+    unsigned char* data;    // NULL for deletions
+    size_t seq;             // inserts at the same offset go in this order
+};
+static struct txop* txOps = NULL;
+static size_t txCount = 0;
+static size_t txCapacity = 0;
+static size_t txSeq = 0;
+
+// what & overwrote, so u can put it back: width bytes at every offset
+static struct {
+    size_t* offsets;
+    size_t n;
+    size_t width;
+    unsigned char* old;     // n * width bytes
+    size_t start;           // the first byte overwritten
+    size_t end;             // one past the last byte overwritten
+} journal = { NULL, 0, 0, NULL, 0, 0 };
+
+// which bytes were modified since the file was opened or saved; NULL until
+// the first edit
+static void* dirty = NULL;
+
+// the record layout for v: records of recordSize bytes with these fields.
+// fieldSpec is how it was typed in, to offer it again next time
+struct field {
+    size_t offset;
+    int width;      // in bytes
+    int be;
+    char type;      // u, s, x or f; see record_key()
+};
+static size_t recordSize = 0;
+static struct field* fields = NULL;
+static size_t nfields = 0;
+static char* fieldSpec = NULL;
+static char* keySpec = NULL;    // the last field records were sorted by
+                                // or looked up by
+
 static char HEX[] = {
     '0', '1', '2', '3', '4', '5', '6', '7',
     '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
     0
 };
 
+// byte -> two hex digits
+#define HEXPAIRS(h) \
+    {h, '0'}, {h, '1'}, {h, '2'}, {h, '3'}, \
+    {h, '4'}, {h, '5'}, {h, '6'}, {h, '7'}, \
+    {h, '8'}, {h, '9'}, {h, 'a'}, {h, 'b'}, \
+    {h, 'c'}, {h, 'd'}, {h, 'e'}, {h, 'f'}
+static const char HEX2[256][2] = {
+    HEXPAIRS('0'), HEXPAIRS('1'), HEXPAIRS('2'), HEXPAIRS('3'),
+    HEXPAIRS('4'), HEXPAIRS('5'), HEXPAIRS('6'), HEXPAIRS('7'),
+    HEXPAIRS('8'), HEXPAIRS('9'), HEXPAIRS('a'), HEXPAIRS('b'),
+    HEXPAIRS('c'), HEXPAIRS('d'), HEXPAIRS('e'), HEXPAIRS('f'),
+};
+#undef HEXPAIRS
+
 static const char* HELP[] = {
 "Key bindings:\n",
 "0-9a-f      edit bytes\n",
@@ -166,6 +537,9 @@ static const char* HELP[] = {
 "pgup/pgdwn  screenful\n",
 "+           jump forward n bytes\n",
 "-           jump backward n bytes\n",
+"]/[         skip run of the byte under the cursor\n",
+"}/{         skip run of a given byte\n",
+"#           list runs of n or more identical bytes\n",
 "^F/^B       screenful\n",
 ")/(         screenful\n",
 "g           goto address; negative means from end\n",
@@ -173,6 +547,14 @@ static const char* HELP[] = {
 "?           rfind\n",
 "n           continue searching forward\n",
 "N           continue searching backward\n",
+"%           replace all, in a region or everywhere\n",
+"&           write the same thing at every search hit\n",
+"u           undo the last &\n",
+"U, ^U       next/previous invalid UTF-8\n",
+";/,         next/previous modified byte\n",
+"D           diff against another file, or stop\n",
+"^N/^P       next/previous difference\n",
+"C           changes since load/save or checkpoint\n",
 "<           insert nulls\n",
 ">           append nulls\n",
 "w, F2, ^S   write file\n",
@@ -183,20 +565,31 @@ static const char* HELP[] = {
 "Q           exit without prompt\n",
 "m           mark\n",
 "M           list marks\n",
+"V           overview: entropy, zeros, text per block\n",
+"S           list strings (ASCII and UTF-16LE)\n",
+"X           list embedded files (gzip, ELF, PNG...)\n",
 "G, ', `     goto mark\n",
 //"^H, DEL     delete/cut region\n",
 "x           delete/cut region\n",
 "W           write region\n",
+"H           checksum/hash region or buffer\n",
+"T           transform region: xor, add, fill, swap...\n",
 "@           blank region\n",
 "y           copy region\n",
 "p           insert clipboard\n",
 "P           append clipboard\n",
 "*           overwrite with clipboard\n",
+"|           queue inserts/deletes/overwrites, apply at once\n",
+"v           view as records of fields, with statistics\n",
+"s           sort records in a region by a field, dedupe\n",
+"t           goto record by value of a field it's sorted by\n",
+"^           guess the record size from repeating bytes\n",
 "^G          show alternative cursor position or cancel\n",
 "ESC ^C      cancel prompt of complicated command\n",
 "$, ^K       truncate file\n",
 "^L          refresh\n",
-//"TAB ^I *    hide byte interpretation\n",
+"^T          toggle latency overlay\n",
+"TAB, ^I     hide/show byte interpretation\n",
 "!, F1       help\n",
 "\n",
 ":, .        punch in (brings up menu)\n",
@@ -242,10 +635,34 @@ void showhelp(const char* argv0)
     printf("jakhex %s by Vlad Mesco\n", VERSION);
     printf("\n");
     printf("Usage: %s file [+offset]\n", argv0);
+    printf("       %s --find pattern file...\n", argv0);
+    printf("       %s --bench-redraw [file]\n", argv0);
+    printf("       %s --stats [file [+offset]]\n", argv0);
+    printf("       %s --trace tracefile [file [+offset]]\n", argv0);
+    printf("       %s --magic magicfile [file [+offset]]\n", argv0);
+    printf("       %s [options] -- file [+offset]\n", argv0);
     printf("\n");
     printf("    -h      show this message\n");
     printf("    +offset initial cursor position.\n");
     printf("            negative means offset from the end\n");
+    printf("    --find  search files for pattern without a UI, printing\n");
+    printf("            file:offset for every hit; pattern uses the\n");
+    printf("            find syntax below\n");
+    printf("    --bench-redraw\n");
+    printf("            page through the file repainting the whole screen\n");
+    printf("            for a couple of seconds, then print frames/second\n");
+    printf("    --stats print latency histograms of commands, redraws and\n");
+    printf("            I/O to stderr on exit\n");
+    printf("    --trace tracefile\n");
+    printf("            record keys, commands, redraws, searches and I/O,\n");
+    printf("            and write them to tracefile as Chrome trace JSON\n");
+    printf("            on exit\n");
+    printf("    --magic magicfile\n");
+    printf("            more signatures for X, one per line, as\n");
+    printf("            `name offset pattern', with pattern in the find\n");
+    printf("            syntax below (no bit patterns)\n");
+    printf("    --      end of options; the next argument is the file,\n");
+    printf("            even if it starts with - or --\n");
     printf("\n");
     for(int i = 0; i < sizeof(HELP)/sizeof(HELP[0]); ++i) {
         printf("%s", HELP[i]);
@@ -253,15 +670,177 @@ void showhelp(const char* argv0)
     exit(1);
 }
 
+struct grep_ctx {
+    char** files;
+    unsigned char* needle;
+    unsigned char* mask;
+    size_t nneedle;
+    pthread_mutex_t lock; // guards stdout, stderr and the flags below
+    int found;
+    int errors;
+};
+
+/* write out a worker's buffered hits */
+static void grep_flush(struct grep_ctx* g, char* out, size_t* nout)
+{
+    if(*nout == 0) return;
+    pthread_mutex_lock(&g->lock);
+    fwrite(out, 1, *nout, stdout);
+    pthread_mutex_unlock(&g->lock);
+    *nout = 0;
+}
+
+static void grep_error(struct grep_ctx* g, const char* file, const char* what)
+{
+    pthread_mutex_lock(&g->lock);
+    fprintf(stderr, "jakhex: %s: %s\n", file, what);
+    g->errors = 1;
+    pthread_mutex_unlock(&g->lock);
+}
+
+/* search one file; runs on a worker thread */
+static void grep_one(size_t idx, void* vctx)
+{
+    struct grep_ctx* g = vctx;
+    const char* file = g->files[idx];
+
+    int fd = open(file, O_RDONLY);
+    if(fd == -1) {
+        grep_error(g, file, strerror(errno));
+        return;
+    }
+
+    struct stat sb;
+    if(-1 == fstat(fd, &sb)) {
+        grep_error(g, file, strerror(errno));
+        close(fd);
+        return;
+    }
+    // same reasoning as open_file2: files only
+    if(!S_ISREG(sb.st_mode)) {
+        grep_error(g, file, "this is not a file!");
+        close(fd);
+        return;
+    }
+    size_t size = sb.st_size;
+    if(size == 0) {
+        close(fd);
+        return;
+    }
+
+    unsigned char* p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED) {
+        grep_error(g, file, strerror(errno));
+        return;
+    }
+    posix_madvise(p, size, POSIX_MADV_SEQUENTIAL);
+
+    void* st = g->mask
+        ? bpatmemsearch_begin(g->needle, g->nneedle, g->mask)
+        : memsearch_begin(g->needle, g->nneedle);
+    if(!st) abort();
+
+    char out[64 * 1024];
+    size_t nout = 0;
+    size_t nfile = strlen(file);
+    int found = 0;
+
+    unsigned char* chunk = p;
+    size_t left = size;
+    while(left > 0) {
+        size_t consumed;
+        unsigned char* hit = memsearch_feed(st, chunk, left, &consumed);
+        chunk += consumed;
+        left -= consumed;
+        if(!hit) continue;
+
+        found = 1;
+        if(nout + nfile + 32 > sizeof(out)) grep_flush(g, out, &nout);
+        size_t offset = (size_t)(hit - p) - (g->nneedle - 1);
+        nout += snprintf(out + nout, sizeof(out) - nout, "%s:%zu\n", file, offset);
+    }
+
+    memsearch_end(st);
+    munmap(p, size);
+
+    grep_flush(g, out, &nout);
+    if(found) {
+        pthread_mutex_lock(&g->lock);
+        g->found = 1;
+        pthread_mutex_unlock(&g->lock);
+    }
+}
+
+/* search a bunch of files for a pattern without bringing up the UI.
+   Prints file:offset for every hit. Files are mmap'd and searched in
+   parallel, so hits from different files come out interleaved.
+   Returns an exit code like grep: 0 if something was found, 1 if
+   not, 2 if there were errors */
+int grep_files(const char* pattern, char** files, int nfiles)
+{
+    struct grep_ctx g;
+    memset(&g, 0, sizeof(g));
+    g.files = files;
+
+    if(!parse_search_string(pattern, &g.needle, &g.nneedle, &g.mask)) {
+        fprintf(stderr, "jakhex: invalid search string: %s\n", pattern);
+        return 2;
+    }
+
+    pthread_mutex_init(&g.lock, NULL);
+    run_parallel(nfiles, grep_one, &g);
+    pthread_mutex_destroy(&g.lock);
+
+    free(g.needle);
+    free(g.mask);
+
+    if(fflush(stdout) != 0) g.errors = 1;
+
+    if(g.errors) return 2;
+    return g.found ? 0 : 1;
+}
+
 /* main */
 int main(int argc, char* argv[])
 {
     /* check command line arguments first; if we need to show help,
        then ncurses needs to be off. */
     ssize_t offset = 0;
+    int bench = 0;
+    const char* argv0 = argv[0];
+    int nomoreoptions = 0;
+    for(; argc > 1 && strncmp(argv[1], "--", 2) == 0; --argc, ++argv) {
+        if(strcmp(argv[1], "--") == 0) {
+            // what follows is a file name, even if it looks like an option
+            --argc, ++argv;
+            nomoreoptions = 1;
+            break;
+        } else if(strcmp(argv[1], "--find") == 0) {
+            if(argc < 4) showhelp(argv0);
+            // the files may come after a --, like everywhere else
+            int first = (argc > 4 && strcmp(argv[3], "--") == 0) ? 4 : 3;
+            exit(grep_files(argv[2], argv + first, argc - first));
+        } else if(strcmp(argv[1], "--bench-redraw") == 0) {
+            bench = 1;
+        } else if(strcmp(argv[1], "--stats") == 0) {
+            dumpStats = 1;
+        } else if(strcmp(argv[1], "--trace") == 0) {
+            if(argc < 3) showhelp(argv0);
+            traceFile = argv[2];
+            --argc, ++argv;
+        } else if(strcmp(argv[1], "--magic") == 0) {
+            if(argc < 3) showhelp(argv0);
+            load_magic(argv[2]);
+            --argc, ++argv;
+        } else {
+            // not one of ours, so it's a file that happens to start with --
+            break;
+        }
+    }
     if(argc > 1) {
-        if(strcmp(argv[1], "-h") == 0) {
-            showhelp(argv[0]);
+        if(!nomoreoptions && strcmp(argv[1], "-h") == 0) {
+            showhelp(argv0);
         }
         if(argc > 2) {
             offset = atol(argv[2]);
@@ -269,8 +848,15 @@ int main(int argc, char* argv[])
         fname = strdup(argv[1]);
     }
 
+    // the last 128Ki events; that's a few MiB
+    if(traceFile && !trace_open(128ul * 1024ul)) {
+        fprintf(stderr, "Out of memory for the trace buffer\n");
+        exit(2);
+    }
+
     /* if there's no tty, complain and exit;
-       if you want to automate binary surgery, do so from C or Python */
+       if you want to automate binary surgery, do so from C or Python.
+       If you only want to look for things, see --find */
     if(!isatty(fileno(stdout)) || !isatty(fileno(stdin))) {
         fprintf(stderr, "Output is not a tty, cowardly exiting!\n");
         exit(2);
@@ -292,6 +878,8 @@ int main(int argc, char* argv[])
     keypad(stdscr, TRUE);
     nonl(); // no NL->CR/NL on output?
     noecho();
+    // let curses use the terminal's insert/delete line when we scroll
+    idlok(stdscr, TRUE);
     //cbreak();
     raw();
     // only enable with switch; maybe have keys to disable mouse...
@@ -326,6 +914,8 @@ int main(int argc, char* argv[])
         test_file();
     }
 
+    if(bench) bench_redraw();
+
     redraw();
 
     // main loop
@@ -334,64 +924,349 @@ int main(int argc, char* argv[])
         int wline = (int)(line - windowOffset);
         int byte = (int)(memoffset % 32);
         int col = 9 + (byte/4) + byte*2 + lownibble;
-        int c = mvgetch(wline, col); // TODO move back to where we "were"
+        int c;
+        if(detailsStale) {
+            timeout(DETAILS_IDLE_MS);
+            c = mvgetch(wline, col);
+            timeout(-1);
+            if(c == ERR) {
+                draw_details();
+                if(showOverlay) draw_separator();
+                c = mvgetch(wline, col); // TODO move back to where we "were"
+            }
+        } else {
+            c = mvgetch(wline, col); // TODO move back to where we "were"
+        }
+        trace_key(c);
 
         update_status(); // reset status line after any key press
 
+        // cursor motions only move the cursor; then whatever else is
+        // already queued up gets drained, and the screen is drawn once
+        // for the lot. Otherwise, holding down a key on a slow link
+        // keeps scrolling long after you let go of it.
+        if(apply_motion(c)) {
+            struct probe p = probe_begin(STAT_MOTION);
+            nodelay(stdscr, TRUE);
+            while((c = getch()) != ERR) {
+                trace_key(c);
+                if(!apply_motion(c)) break;
+            }
+            nodelay(stdscr, FALSE);
+            // not a motion; leave it for the next iteration
+            if(c != ERR) {
+                ungetch(c);
+                trace_key(ERR);
+            }
+
+            adjust_screen();
+            update_details();
+            update_status();
+            probe_end(p);
+            lastCommand = STAT_MOTION;
+            if(showOverlay) draw_separator();
+            continue;
+        }
+
         // handle whatever key was pressed
+        struct probe p = probe_begin(c);
         handle_keys(c);
+        probe_end(p);
+        lastCommand = c;
+        if(showOverlay) draw_separator();
     }
 
     return 0;
 }
 
-// clear and fully redraw screen. Useful if you jumped a screenful
-// or if you're coming back from a subscreen.
+// clear and fully redraw screen. Useful if you're coming back from a
+// subscreen, or if the terminal got garbled.
 void redraw(void)
 {
+    struct probe p = probe_begin(STAT_REDRAW);
     clear();
 
     // print file
-    for(size_t i = 0; i < LINES - 10 - 1; ++i) {
-        size_t loffset = (windowOffset + i) * 32ul;
-        // address of first byte of line
-        attron(A_STANDOUT);
-        mvaddch(i, 0, HEX[(loffset >>28) & 0xF]);
-        mvaddch(i, 1, HEX[(loffset >>24) & 0xF]);
-        mvaddch(i, 2, HEX[(loffset >>20) & 0xF]);
-        mvaddch(i, 3, HEX[(loffset >>16) & 0xF]);
-        mvaddch(i, 4, HEX[(loffset >>12) & 0xF]);
-        mvaddch(i, 5, HEX[(loffset >> 8) & 0xF]);
-        mvaddch(i, 6, HEX[(loffset >> 4) & 0xF]);
-        mvaddch(i, 7, HEX[(loffset >> 0) & 0xF]);
-        attroff(A_STANDOUT);
-        // 32 bytes
-        for(int b = 0; b < 32; ++b) {
-            int col = 9 // addr column
-                    + (b/4) // number of full words
-                    + b*2;
-            size_t off = (windowOffset + i) * 32ul + (unsigned long)b;
-            if(off >= memsize) break;
-            mvaddch(i, col, HEX[mem[off] >> 4]);
-            mvaddch(i, col+1, HEX[mem[off] & 0xF]);
-        }
-    }
+    paintedLines = 0;
+    repaint();
 
     // separate details panel
-    attron(A_STANDOUT);
-    mvhline(LINES - 10 - 1, 0, '-', COLS);
-    attroff(A_STANDOUT);
+    draw_separator();
 
     // print details (e.g. int, float, string interpretations of bytes)
     update_details();
     // update status line to show cursor position
     update_status();
+    probe_end(p);
+}
+
+// the line between the hex rows and the details pane. Also where the
+// latency overlay goes, if it's on
+void draw_separator(void)
+{
+    attron(A_STANDOUT);
+    mvhline(view_lines(), 0, '-', COLS);
+    if(showOverlay) {
+        char line[256], b1[16], b2[16], b3[16], b4[16], b5[16], b6[16];
+        int n = 0;
+        if(lastCommand >= 0) {
+            n = snprintf(line, sizeof(line), " %s %s p99 %s |",
+                    slot_name(lastCommand),
+                    stats_format(stats_last(lastCommand), b1, sizeof(b1)),
+                    stats_format(stats_percentile(lastCommand, 99.0), b2, sizeof(b2)));
+        }
+        snprintf(line + n, sizeof(line) - n,
+                " repaint %s p99 %s | details %s p99 %s ",
+                stats_format(stats_last(STAT_REPAINT), b3, sizeof(b3)),
+                stats_format(stats_percentile(STAT_REPAINT, 99.0), b4, sizeof(b4)),
+                stats_format(stats_last(STAT_DETAILS), b5, sizeof(b5)),
+                stats_format(stats_percentile(STAT_DETAILS, 99.0), b6, sizeof(b6)));
+        mvaddnstr(view_lines(), 0, line, COLS);
+    }
+    attroff(A_STANDOUT);
+}
+
+// bytes [a1, a2) of mem have changed. a2 == SIZE_MAX means everything
+// from a1 onwards may have moved, e.g. after inserting or deleting bytes.
+void mem_changed(size_t a1, size_t a2)
+{
+    size_t l1 = a1 / 32;
+    size_t l2 = (a2 == SIZE_MAX) ? SIZE_MAX : (a2 + 31) / 32;
+    if(dirtyFrom >= dirtyTo) {
+        dirtyFrom = l1;
+        dirtyTo = l2;
+    } else {
+        if(l1 < dirtyFrom) dirtyFrom = l1;
+        if(l2 > dirtyTo) dirtyTo = l2;
+    }
+    if(summary) {
+        if(a1 < summaryStaleFrom) summaryStaleFrom = a1;
+        if(a2 > summaryStaleTo) summaryStaleTo = a2;
+    }
+    if(merkle) {
+        if(a1 < merkleStaleFrom) merkleStaleFrom = a1;
+        if(a2 > merkleStaleTo) merkleStaleTo = a2;
+    }
+    if(a2 != SIZE_MAX && a1 < a2) {
+        if(!dirty) dirty = dirty_new(memsize);
+        if(dirty) dirty_mark(dirty, a1, a2);
+    }
+    // bytes changed or moved under what & overwrote; putting the old bytes
+    // back would clobber whatever is there now
+    if(journal.offsets && a1 < journal.end && a2 > journal.start) {
+        free(journal.offsets);
+        free(journal.old);
+        journal.offsets = NULL;
+        journal.old = NULL;
+    }
+    // what got lined up with what in the diff is out of date
+    if(diffSync && a2 == SIZE_MAX) {
+        sync_reset(diffSync);
+        if(a1 < diffLearned) diffLearned = 0;
+    }
+}
+
+// repaint the hex rows which are out of date, i.e. which changed since the
+// last repaint (see mem_changed) or which scrolled into view. If the
+// window moved by less than a screenful, the rows which are still good
+// get scrolled instead of being printed again.
+void repaint(void)
+{
+    struct probe p = probe_begin(STAT_REPAINT);
+    int nlines = view_lines();
+
+    if(paintedLines != nlines) {
+        for(int i = 0; i < nlines; ++i) draw_line(i);
+    } else if(windowOffset != paintedWindowOffset) {
+        size_t delta = (windowOffset > paintedWindowOffset)
+                     ? windowOffset - paintedWindowOffset
+                     : paintedWindowOffset - windowOffset;
+        if(delta < (size_t)nlines) {
+            int n = (int)delta;
+            setscrreg(0, nlines - 1);
+            scrollok(stdscr, TRUE);
+            scrl(windowOffset > paintedWindowOffset ? n : -n);
+            scrollok(stdscr, FALSE);
+            setscrreg(0, LINES - 1);
+            if(windowOffset > paintedWindowOffset) {
+                for(int i = nlines - n; i < nlines; ++i) draw_line(i);
+            } else {
+                for(int i = 0; i < n; ++i) draw_line(i);
+            }
+        } else {
+            for(int i = 0; i < nlines; ++i) draw_line(i);
+        }
+    }
+
+    // whatever changed in the buffer
+    for(int i = 0; i < nlines && dirtyFrom < dirtyTo; ++i) {
+        size_t l = windowOffset + i;
+        if(l >= dirtyFrom && l < dirtyTo) draw_line(i);
+    }
+
+    dirtyFrom = dirtyTo = 0;
+    paintedWindowOffset = windowOffset;
+    paintedLines = nlines;
+    probe_end(p);
+}
+
+// print the i-th hex row on screen. The row is put together in a buffer
+// and goes out in one go, since curses calls per character add up.
+void draw_line(int i)
+{
+    chtype row[80];
+    size_t loffset = (windowOffset + i) * 32ul;
+
+    // address of first byte of line
+    for(int c = 0; c < 8; c += 2) {
+        const char* h = HEX2[(loffset >> (24 - 4 * c)) & 0xFF];
+        row[c] = (chtype)h[0] | A_STANDOUT;
+        row[c + 1] = (chtype)h[1] | A_STANDOUT;
+    }
+    row[8] = ' ';
+
+    // 32 bytes in 8 words: "00112233 44556677 ..."
+    size_t nbytes = (loffset < memsize) ? memsize - loffset : 0;
+    if(nbytes > 32) nbytes = 32;
+    chtype* p = row + 9;
+    for(size_t b = 0; b < 32; ++b) {
+        if(b < nbytes) {
+            const char* h = HEX2[mem[loffset + b]];
+            chtype attr = (diffSync && differs(loffset + b)) ? A_REVERSE : 0;
+            if(dirty && dirty_test(dirty, loffset + b)) attr |= A_BOLD;
+            p[0] = (chtype)h[0] | attr;
+            p[1] = (chtype)h[1] | attr;
+        } else {
+            p[0] = p[1] = ' ';
+        }
+        p += 2;
+        if(b % 4 == 3 && b < 31) *p++ = ' ';
+    }
+
+    int n = COLS < 80 ? COLS : 80;
+    mvaddchnstr(i, 0, row, n);
+    if(COLS > 80) {
+        move(i, 80);
+        clrtoeol();
+    }
+}
+
+/* repaint the whole screen over and over while paging through the buffer,
+   then print how many frames per second we managed and exit */
+void bench_redraw(void)
+{
+    int nlines = view_lines();
+    size_t buflines = (memsize + 31) / 32;
+    if(buflines == 0) buflines = 1;
+
+    struct timespec t0, t1;
+    double elapsed = 0.0;
+    long frames = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    do {
+        windowOffset = ((size_t)frames * nlines) % buflines;
+        paintedLines = 0;
+        repaint();
+        refresh();
+        ++frames;
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        elapsed = (double)(t1.tv_sec - t0.tv_sec)
+                + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+    } while(elapsed < 2.0);
+
+    endwin();
+    printf("%ld frames of %dx%d in %.3fs: %.1f frames per second\n",
+            frames, COLS, LINES, elapsed, (double)frames / elapsed);
+    exit(0);
+}
+
+/* monotonic clock, in nanoseconds */
+unsigned long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000ul + (unsigned long)ts.tv_nsec;
+}
+
+/* start timing something that gets recorded in `slot' (a key code or
+   enum STAT_SLOT) */
+struct probe probe_begin(int slot)
+{
+    struct probe p;
+    p.slot = slot;
+    p.waited = inputWaitNs;
+    p.bytes = 0;
+    p.start = now_ns();
+    if(trace_enabled()) trace_event('B', slot_name(slot), p.start, NULL, 0);
+    return p;
+}
+
+/* stop timing and record the sample. Time spent waiting on the user in
+   prompts doesn't count */
+void probe_end(struct probe p)
+{
+    unsigned long end = now_ns();
+    unsigned long ns = end - p.start - (inputWaitNs - p.waited);
+    stats_record(p.slot, ns);
+    if(trace_enabled()) {
+        int io = (p.slot == STAT_SEARCH || p.slot == STAT_READ || p.slot == STAT_WRITE);
+        trace_event('E', slot_name(p.slot), end, io ? "bytes" : NULL, p.bytes);
+    }
+}
+
+/* human readable name of a stats slot */
+const char* slot_name(int slot)
+{
+    static char buf[32];
+    switch(slot) {
+        case STAT_REDRAW: return "redraw";
+        case STAT_REPAINT: return "repaint";
+        case STAT_DETAILS: return "details";
+        case STAT_MOTION: return "motion";
+        case STAT_SEARCH: return "search";
+        case STAT_READ: return "read";
+        case STAT_WRITE: return "write";
+    }
+    const char* k = keyname(slot);
+    snprintf(buf, sizeof(buf), "key %s", k ? k : "?");
+    return buf;
+}
+
+/* record a key coming in from the main loop in the trace. Keys that were
+   pushed back with ungetch() come in twice; call this with ERR after the
+   ungetch() to skip the second one */
+void trace_key(int c)
+{
+    static int skip = 0;
+    if(c == ERR) {
+        skip = 1;
+        return;
+    }
+    if(skip) {
+        skip = 0;
+        return;
+    }
+    if(trace_enabled()) trace_event('i', slot_name(c), now_ns(), "keycode", (unsigned long)c);
+}
+
+/* getch() for prompts. Time spent in here is the user thinking, so it's
+   taken out of the latency of whatever command is prompting */
+int getkey(void)
+{
+    unsigned long t0 = now_ns();
+    int c = getch();
+    inputWaitNs += now_ns() - t0;
+    return c;
 }
 
 /* exits program. Tears down curses beforehand */
 void finish(void)
 {
     endwin();
+    if(dumpStats) stats_dump(stderr, slot_name);
+    if(traceFile && !trace_write(traceFile)) {
+        fprintf(stderr, "Failed to write %s: %s\n", traceFile, strerror(errno));
+    }
     // TODO save swap file if we can and we didn't force quit?
     //      note: endwin() is unsafe to call in a signal handler
     exit(0);
@@ -439,8 +1314,8 @@ void test_file(void)
     memcpy(mem + strlen(hellotext) + sizeof(floats) + sizeof(dbls), specials, sizeof(specials));
 }
 
-/* cursor movement motion. dir is enum DIR */
-void mymove(int dir)
+/* move the cursor without updating the screen. dir is enum DIR */
+void step(int dir)
 {
     switch(dir) {
     case RIGHT:
@@ -462,6 +1337,12 @@ void mymove(int dir)
         memoffset -= 32;
         break;
     }
+}
+
+/* cursor movement motion. dir is enum DIR */
+void mymove(int dir)
+{
+    step(dir);
 
     // we may have jumped off screen
     adjust_screen();
@@ -469,25 +1350,22 @@ void mymove(int dir)
     update_details();
 }
 
-/* move one screenful at a time */
-void pagemove(int dir)
+/* move one screenful at a time, without updating the screen */
+void page_step(int dir)
 {
-    int page = (LINES - 10 - 1) * 32;
-    int nlines = (LINES - 10 - 1);
+    int page = view_lines() * 32;
+    int nlines = view_lines();
     switch(dir) {
     case DOWN:
         if(memsize < page || memoffset >= memsize - page) {
             memoffset = memsize - (memsize > 0);
-            adjust_screen();
-            update_details();
-            update_status();
+            adjust_window();
         } else {
             memoffset += page;
             windowOffset += nlines;
             if(windowOffset * 32 > memoffset) {
                 windowOffset = memsize / 32;
             }
-            redraw();
         }
         break;
     case UP:
@@ -498,31 +1376,92 @@ void pagemove(int dir)
             } else {
                 windowOffset = 0;
             }
-            redraw();
         } else {
             memoffset = 0;
             windowOffset = 0;
-            redraw();
         }
         break;
     }
 }
 
+/* if `c' is a plain cursor motion key in the current mode, move the
+   cursor without updating the screen and return 1. Otherwise return 0.
+   This is how the main loop handles all cursor motions, so that bursts
+   of them get drawn once. */
+int apply_motion(int c)
+{
+    if(handle_keys == handle_text) {
+        // we operate on full bytes
+        int moved = 1;
+        lownibble = 0;
+        switch(c) {
+            case KEY_BACKSPACE:
+            case 127: // delete
+            case 8: // ^H
+            case KEY_LEFT:
+                step(LEFT);
+                step(LEFT);
+                break;
+            case KEY_RIGHT:
+                step(RIGHT);
+                step(RIGHT);
+                break;
+            case KEY_UP: step(UP); break;
+            case KEY_DOWN: step(DOWN); break;
+            case 6:
+            case KEY_NPAGE: page_step(DOWN); break;
+            case 2:
+            case KEY_PPAGE: page_step(UP); break;
+            default: moved = 0; break;
+        }
+        lownibble = 0;
+        return moved;
+    }
+
+    switch(c) {
+        case ' ':
+        case KEY_RIGHT:
+        case 'l': step(RIGHT); return 1;
+        case KEY_LEFT:
+        case KEY_BACKSPACE:
+        case 127: // delete
+        case 8: // ^H
+        case 'h': step(LEFT); return 1;
+        case KEY_DOWN:
+        case 'j': step(DOWN); return 1;
+        case KEY_UP:
+        case 'k': step(UP); return 1;
+        case 6: // ^F
+        case ')':
+        case KEY_NPAGE: page_step(DOWN); return 1;
+        case '(':
+        case 2: // ^B
+        case KEY_PPAGE: page_step(UP); return 1;
+    }
+    return 0;
+}
+
 /* call after moving the cursor, in case we've moved off screen */
 void adjust_screen(void)
+{
+    adjust_window();
+    repaint();
+}
+
+/* scroll the window so the cursor is on screen, without updating the screen */
+void adjust_window(void)
 {
     size_t l = memoffset / 32;
     size_t a = windowOffset;
-    size_t b = windowOffset + LINES - 10 - 1;
+    size_t b = windowOffset + view_lines();
 
     if(l < a || l >= b) {
-        if(l > ((LINES - 10 - 1) / 2)) {
-            windowOffset = l - ((LINES - 10 - 1) / 2);
+        if(l > (view_lines() / 2)) {
+            windowOffset = l - (view_lines() / 2);
             if(windowOffset >= memsize / 32) windowOffset = (memsize - 1) / 32;
         } else {
             windowOffset = 0;
         }
-        redraw();
     }
 }
 
@@ -554,13 +1493,10 @@ void update_status(void)
         attroff(A_STANDOUT);
     }
     mvaddch(LINES - 1, 1, ' ');
-    size_t lll = strlen(fname);
-    for(size_t i = 0; i < COLS - 22 - 2; ++i) {
-        // TODO utf-8/unicode in general
-        // TODO right align and trim left
-        char c = (i < lll) ? fname[i] : ' ';
-        mvaddch(LINES - 1, 2 + i, c);
-    }
+    // TODO utf-8/unicode in general
+    // TODO right align and trim left
+    int width = COLS - 22 - 2;
+    if(width > 0) mvprintw(LINES - 1, 2, "%-*.*s", width, width, fname);
 
     // file position
     if(memsize > 0xFFFFFFFFul) {
@@ -576,19 +1512,38 @@ void update_status(void)
     mvprintw(LINES - 1, COLS - 5, "%3d%%", percent);
 }
 
-/* update details pane, showing byte interpretations as int, float, string etc */
+/* how many hex rows fit on screen */
+int view_lines(void)
+{
+    // the status line, the separator, and the details pane if shown
+    return detailsHidden ? LINES - 1 - 1 : LINES - 10 - 1;
+}
+
+/* note that the details pane is out of date. It's worked out in
+   draw_details() once input goes idle, so bursts of keys don't pay for it
+   on every key */
 void update_details(void)
 {
+    detailsStale = 1;
+}
+
+/* update details pane, showing byte interpretations as int, float, string etc */
+void draw_details(void)
+{
+    detailsStale = 0;
+    if(detailsHidden) return;
+    struct probe p = probe_begin(STAT_DETAILS);
+
     // as bytes
     mvprintw(LINES - 9 - 1, 0, "c: %c", isprint(mem[memoffset]) ? mem[memoffset] : ' ');
     mvprintw(LINES - 9 - 1, 8, "u8: %-3u", mem[memoffset]);
     mvprintw(LINES - 9 - 1, 16, "s8: %-4d", (int)((signed char)mem[memoffset]));
     // as shorts
     if(memoffset <= memsize - 2) {
-        unsigned i16le = mem[memoffset] | (mem[memoffset + 1] << 8);
+        unsigned i16le = (unsigned)record_load(mem + memoffset, 2, 0);
         mvprintw(LINES - 9 - 1, 25, "u16le: %-5u", i16le);
         mvprintw(LINES - 9 - 1, 25 + 13, "s16le: %-6d", (int)((signed short)i16le));
-        unsigned i16be = (mem[memoffset] << 8) | mem[memoffset + 1];
+        unsigned i16be = (unsigned)record_load(mem + memoffset, 2, 1);
         mvprintw(LINES - 9 - 1, 25 + 13 + 14, "u16be: %-5u", i16be);
         mvprintw(LINES - 9 - 1, 25 + 13 + 14 + 13, "s16be: %-6d", (int)((signed short)i16be));
     } else {
@@ -597,12 +1552,8 @@ void update_details(void)
 
     // as 32bits
     if(memoffset <= memsize - 4) {
-        unsigned i32le = mem[memoffset] | (mem[memoffset + 1] << 8)
-                  | (mem[memoffset + 2] << 16) | (mem[memoffset + 3] << 24)
-                  ;
-        unsigned i32be = mem[memoffset + 3] | (mem[memoffset + 2] << 8)
-                  | (mem[memoffset + 1] << 16) | (mem[memoffset + 0] << 24)
-                  ;
+        unsigned i32le = (unsigned)record_load(mem + memoffset, 4, 0);
+        unsigned i32be = (unsigned)record_load(mem + memoffset, 4, 1);
         mvprintw(LINES - 8 - 1, 0, "u32le: %-10u", i32le);
         mvprintw(LINES - 8 - 1, 18, "s32le: %-11d", *((signed*)&i32le));
         mvprintw(LINES - 8 - 1, 18 + 19, "u32be: %-10u", i32be);
@@ -618,22 +1569,8 @@ void update_details(void)
     }
     // as 64bits
     if(memoffset <= memsize - 8) {
-        unsigned long i64le = mem[memoffset + 7]; i64le <<= 8;
-        i64le |= mem[memoffset + 6]; i64le <<= 8;
-        i64le |= mem[memoffset + 5]; i64le <<= 8;
-        i64le |= mem[memoffset + 4]; i64le <<= 8;
-        i64le |= mem[memoffset + 3]; i64le <<= 8;
-        i64le |= mem[memoffset + 2]; i64le <<= 8;
-        i64le |= mem[memoffset + 1]; i64le <<= 8;
-        i64le |= mem[memoffset + 0];
-        unsigned long i64be = mem[memoffset + 0]; i64be <<= 8;
-        i64be |= mem[memoffset + 1]; i64be <<= 8;
-        i64be |= mem[memoffset + 2]; i64be <<= 8;
-        i64be |= mem[memoffset + 3]; i64be <<= 8;
-        i64be |= mem[memoffset + 4]; i64be <<= 8;
-        i64be |= mem[memoffset + 5]; i64be <<= 8;
-        i64be |= mem[memoffset + 6]; i64be <<= 8;
-        i64be |= mem[memoffset + 7];
+        unsigned long i64le = (unsigned long)record_load(mem + memoffset, 8, 0);
+        unsigned long i64be = (unsigned long)record_load(mem + memoffset, 8, 1);
         mvprintw(LINES - 7 - 1, 0, "u64le: %-20lu", i64le);
         mvprintw(LINES - 7 - 1, 28, "s64le: %-21ld", *((signed long*)&i64le));
         mvprintw(LINES - 7 - 1, 57, "h64le: %016lx", i64le);
@@ -668,6 +1605,7 @@ void update_details(void)
             : ' ';
     }
     mvprintw(LINES - 1 - 1, 0, "s: [%s]", toPrint);
+    probe_end(p);
 }
 
 /* punch in one hex character */
@@ -691,6 +1629,8 @@ void punch(int ic)
         ;
 
 
+    mem_changed(memoffset, memoffset + 1);
+
     // update screen...
     int l = (int)(memoffset / 32 - windowOffset);
     int sb = (int)(memoffset % 32);
@@ -707,11 +1647,82 @@ void overwrite_mem(void* rawbytes, size_t nbytes)
     if(memoffset + nbytes > memsize) {
         mvhline(LINES - 1, 0, ' ', COLS);
         mvprintw(LINES - 1, 0, "Won't fit!");
-        getch();
+        getkey();
         return;
     }
 
     memcpy(mem + memoffset, bytes, nbytes);
+    mem_changed(memoffset, memoffset + nbytes);
+}
+
+/* converts the number in s to bytes as picked in the punch in menu (see
+   punch_interpreted) and returns how many bytes that is */
+size_t encode_value(char choice, const char* s, unsigned char out[8])
+{
+    switch(choice) {
+        case '1':
+        case '2':
+            {
+                unsigned short nn = 0;
+                sscanf(s, "%hi", &nn);
+                if(choice == '2') nn = ((nn >> 8) & 0xFFu) | ((nn << 8) & 0xFF00u);
+                memcpy(out, &nn, 2);
+                return 2;
+            }
+        case '3':
+        case '4':
+            {
+                unsigned int nn = 0;
+                sscanf(s, "%i", &nn);
+                memcpy(out, &nn, 4);
+                if(choice == '4') {
+                    unsigned char* pn = (unsigned char*)(&nn);
+                    for(int i = 0; i < 4; ++i) out[i] = pn[3 - i];
+                }
+                return 4;
+            }
+        case '5':
+        case '6':
+            {
+                unsigned long nn = 0;
+                sscanf(s, "%li", &nn);
+                memcpy(out, &nn, 8);
+                if(choice == '6') {
+                    unsigned char* pn = (unsigned char*)(&nn);
+                    for(int i = 0; i < 8; ++i) out[i] = pn[7 - i];
+                }
+                return 8;
+            }
+        case '7':
+        case '8':
+            {
+                double dn = 0.0;
+                float nn;
+                // read float as double, otherwise it's impossible
+                // to type in 3.14159
+                sscanf(s, "%lf", &dn);
+                nn = (float)dn;
+                memcpy(out, &nn, 4);
+                if(choice == '8') {
+                    unsigned char* pn = (unsigned char*)(&nn);
+                    for(int i = 0; i < 4; ++i) out[i] = pn[3 - i];
+                }
+                return 4;
+            }
+        case 'q':
+        case 'w':
+            {
+                double nn = 0.0;
+                sscanf(s, "%lf", &nn);
+                memcpy(out, &nn, 8);
+                if(choice == 'w') {
+                    unsigned char* pn = (unsigned char*)(&nn);
+                    for(int i = 0; i < 8; ++i) out[i] = pn[7 - i];
+                }
+                return 8;
+            }
+    }
+    return 0;
 }
 
 /* ask the user for formatted data, then punch in said data starting at
@@ -752,110 +1763,24 @@ void punch_interpreted(void)
             {
                 char* s = read_string("enter scanf-friendly number: ");
                 if(!s) break;
-                
-                switch(choice) {
-                    case '1':
-                        {
-                            unsigned short nn;
-                            sscanf(s, "%hi", &nn);
-                            overwrite_mem(&nn, 2);
-                        }
-                        break;
-                    case '2':
-                        {
-                            unsigned short nn;
-                            sscanf(s, "%hi", &nn);
-                            nn = ((nn >> 8) & 0xFFu) | ((nn << 8) & 0xFF00u);
-                            overwrite_mem(&nn, 2);
-                        }
-                        break;
-                    case '3':
-                        {
-                            unsigned int nn;
-                            sscanf(s, "%i", &nn);
-                            overwrite_mem(&nn, 4);
-                        }
-                        break;
-                    case '4':
-                        {
-                            unsigned int nn;
-                            sscanf(s, "%i", &nn);
-                            unsigned char* pn = (unsigned char*)(&nn);
-                            unsigned char p[4] = {
-                                pn[3], pn[2], pn[1], pn[0]
-                            };
-                            overwrite_mem(p, 4);
-                        }
-                        break;
-                    case '5':
-                        {
-                            unsigned long nn;
-                            sscanf(s, "%li", &nn);
-                            overwrite_mem(&nn, 8);
-                        }
-                        break;
-                    case '6':
-                        {
-                            unsigned long nn;
-                            sscanf(s, "%li", &nn);
-                            unsigned char* pn = (unsigned char*)(&nn);
-                            unsigned char p[8] = {
-                                pn[7], pn[6], pn[5], pn[4],
-                                pn[3], pn[2], pn[1], pn[0]
-                            };
-                            overwrite_mem(p, 8);
-                        }
-                        break;
-                    case '7':
-                        {
-                            double dn;
-                            float nn;
-                            // read float as double, otherwise it's impossible
-                            // to type in 3.14159
-                            sscanf(s, "%lf", &dn);
-                            nn = (float)dn;
-                            overwrite_mem(&nn, 4);
-                        }
-                        break;
-                    case '8':
-                        {
-                            double dn;
-                            float nn;
-                            sscanf(s, "%lf", &dn);
-                            nn = (float)dn;
-                            unsigned char* pn = (unsigned char*)(&nn);
-                            unsigned char p[4] = {
-                                pn[3], pn[2], pn[1], pn[0]
-                            };
-                            overwrite_mem(p, 4);
-                        }
-                        break;
-                    case 'q':
-                        {
-                            double nn;
-                            sscanf(s, "%lf", &nn);
-                            overwrite_mem(&nn, 8);
-                        }
-                        break;
-                    case 'w':
-                        {
-                            double nn;
-                            sscanf(s, "%lf", &nn);
-                            unsigned char* pn = (unsigned char*)(&nn);
-                            unsigned char p[8] = {
-                                pn[7], pn[6], pn[5], pn[4],
-                                pn[3], pn[2], pn[1], pn[0]
-                            };
-                            overwrite_mem(p, 8);
-                        }
-                        break;
-                }
+                unsigned char bytes[8];
+                size_t n = encode_value(choice, s, bytes);
+                overwrite_mem(bytes, n);
                 free(s);
             }
             break;
     }
 
-    redraw();
+    // the menu scribbled over the details pane, or over the bottom
+    // rows if it's hidden
+    for(int i = LINES - 9 - 1; i < LINES - 1; ++i) {
+        mvhline(i, 0, ' ', COLS);
+    }
+    paintedLines = 0;
+    repaint();
+    draw_separator();
+    update_details();
+    update_status();
 }
 
 /* punch in ASCII characters in text input mode */
@@ -865,6 +1790,7 @@ void punch_ascii(int c)
     int sb = (int)(memoffset % 32);
     int sc = 9 + sb / 4 + sb * 2 + lownibble;
     mem[memoffset] = c & 0xFF;
+    mem_changed(memoffset, memoffset + 1);
     mvaddch(l, sc+0, HEX[(c >> 4) & 0xF]);
     mvaddch(l, sc+1, HEX[(c >> 0) & 0xF]);
     mymove(RIGHT);
@@ -878,7 +1804,7 @@ int question(const char* q)
     mvprintw(LINES - 1, 0, "%s (Y/N)", q);
 
     while(1) {
-        int c = getch();
+        int c = getkey();
         if(c == 'y' || c == 'Y') return 1;
         if(c == 'N' || c == 'n') return 0;
         if(c == 3) return 0; // int
@@ -898,14 +1824,14 @@ void myhelp(void)
 	for(int i = 0; i < sizeof(HELP)/sizeof(HELP[0]); ++i, ++n) {
         if(n >= LINES - 1) {
             mvprintw(n, 0, "Press any key to continue...");
-            getch();
+            getkey();
             n = 0;
             clear();
         }
 		mvprintw(n, 0, "%s", HELP[i]);
 	}
     mvprintw(n, 0, "Press any key to continue...");
-    getch();
+    getkey();
     redraw();
 }
 
@@ -957,19 +1883,18 @@ void handle_normal(int c)
                   }
                   break;
         case 12: redraw(); break;// ^L
+        case 20: // ^T
+                  showOverlay = !showOverlay;
+                  draw_separator();
+                  break;
+        case 9: // TAB
+                  detailsHidden = !detailsHidden;
+                  adjust_window();
+                  redraw();
+                  break;
+        case KEY_RESIZE: redraw(); break;
         case 26: kill(getpid(), SIGTSTP); break; // ^Z
-        case ' ':
-        case KEY_RIGHT:
-        case 'l': mymove(RIGHT); break;
-        case KEY_LEFT:
-        case KEY_BACKSPACE:
-        case 127: // delete
-        case 8: // ^H
-        case 'h': mymove(LEFT); break;
-        case KEY_DOWN:
-        case 'j': mymove(DOWN); break;
-        case KEY_UP:
-        case 'k': mymove(UP); break;
+        // cursor motions are handled in apply_motion()
         case '0': case '1': case '2': case '3':
         case '4': case '5': case '6': case '7':
         case '8': case '9': case 'a': case 'b':
@@ -1003,20 +1928,31 @@ void handle_normal(int c)
         case '-':
                   advance_offset(-1);
                   break;
+        case ']':
+                  skip_run(+1, 0);
+                  break;
+        case '[':
+                  skip_run(-1, 0);
+                  break;
+        case '}':
+                  skip_run(+1, 1);
+                  break;
+        case '{':
+                  skip_run(-1, 1);
+                  break;
+        case '#':
+                  list_runs();
+                  break;
         case '!':
         case KEY_F(1):
                   myhelp(); break;
-        case 6: // ^F
-        case ')':
-        case KEY_NPAGE: pagemove(DOWN); break;
-        case '(':
-        case 2: // ^B
-        case KEY_PPAGE: pagemove(UP); break;
         case KEY_HOME:
                         memoffset = 0;
                         windowOffset = 0;
                         lownibble = 0;
-                        redraw();
+                        repaint();
+                        update_details();
+                        update_status();
                         break;
         case KEY_END:
                         memoffset = memsize - 1;
@@ -1063,12 +1999,54 @@ void handle_normal(int c)
         case 'N':
                         find_backward(0);
                         break;
+        case '%':
+                        replace_all();
+                        break;
+        case '&':
+                        apply_to_hits();
+                        break;
+        case 'u':
+                        undo_apply();
+                        break;
+        case 'U':
+                        find_invalid_utf8(+1);
+                        break;
+        case 21: // ^U
+                        find_invalid_utf8(-1);
+                        break;
+        case ';':
+                        find_modified(+1);
+                        break;
+        case ',':
+                        find_modified(-1);
+                        break;
+        case 'C':
+                        compare_blocks();
+                        break;
+        case 'D':
+                        diff_open();
+                        break;
+        case 14: // ^N
+                        diff_jump(+1);
+                        break;
+        case 16: // ^P
+                        diff_jump(-1);
+                        break;
         case 'm':
                         set_marker();
                         break;
         case 'M':
                         list_markers();
                         break;
+        case 'V':
+                        overview();
+                        break;
+        case 'S':
+                        list_strings();
+                        break;
+        case 'X':
+                        carve_files();
+                        break;
         case '\'':
         case '`':
         case 'G':
@@ -1095,6 +2073,27 @@ void handle_normal(int c)
         case 'W':
                         write_region();
                         break;
+        case '|':
+                        transaction();
+                        break;
+        case 'H':
+                        hash_region();
+                        break;
+        case 'T':
+                        transform_region();
+                        break;
+        case 'v':
+                        record_view();
+                        break;
+        case 's':
+                        sort_records();
+                        break;
+        case 't':
+                        bisect_records();
+                        break;
+        case '^':
+                        find_period();
+                        break;
         case 7: // ^G
                         show_detailed_cursor();
                         break;
@@ -1139,36 +2138,17 @@ void handle_text(int c)
         case KEY_F(1):
             myhelp();
             break;
-        case KEY_BACKSPACE:
-        case 127: // delete
-        case 8: // ^H
-        case KEY_LEFT:
-            mymove(LEFT);
-            mymove(LEFT);
-            break;
-        case KEY_RIGHT:
-            mymove(RIGHT);
-            mymove(RIGHT);
-            break;
-        case KEY_UP:
-            mymove(UP);
-            break;
-        case KEY_DOWN:
-            mymove(DOWN);
-            break;
-        case 6:
-        case KEY_NPAGE:
-            pagemove(DOWN);
-            break;
-        case 2:
-        case KEY_PPAGE:
-            pagemove(UP);
+        case KEY_RESIZE:
+            redraw();
             break;
+        // cursor motions are handled in apply_motion()
         case KEY_HOME:
             memoffset = 0;
             windowOffset = 0;
             lownibble = 0;
-            redraw();
+            repaint();
+            update_details();
+            update_status();
             break;
         case KEY_END:
             memoffset = memsize - 1;
@@ -1207,6 +2187,12 @@ void insert_n_nulls(size_t before, size_t nbytes)
     memmove(mem + before + nbytes, mem + before, memsize - before);
     memset(mem + before, 0, nbytes);
     memsize += nbytes;
+    if(dirty && !dirty_insert(dirty, before, nbytes)) {
+        dirty_free(dirty);
+        dirty = NULL;
+    }
+    mem_changed(before, SIZE_MAX);
+    mem_changed(before, before + nbytes);
 }
 
 /* insert command; prompt the user how many bytes to insert */
@@ -1220,7 +2206,8 @@ void insert_nulls(size_t before)
     int col = 17;
     int out = 0;
     while(!out) {
-        int c = mvgetch(LINES - 1, col + nbuf);
+        move(LINES - 1, col + nbuf);
+        int c = getkey();
         switch(c) {
             case '0': case '1': case '2': case '4': case '5':
             case '6': case '7': case '8': case '9': case '3':
@@ -1261,7 +2248,9 @@ void insert_nulls(size_t before)
 
     insert_n_nulls(before, nbytes);
 
-    redraw();
+    repaint();
+    update_details();
+    update_status();
 }
 
 /* truncate file at position `at' */
@@ -1269,8 +2258,13 @@ void truncate_file(size_t at)
 {
     memsize = at;
     memoffset = (at > 0) ? at - 1 : 0;
+    if(dirty) dirty_delete(dirty, at, SIZE_MAX);
     lownibble = 0;
-    redraw();
+    mem_changed(at, SIZE_MAX);
+    adjust_screen();
+    repaint();
+    update_details();
+    update_status();
 }
 
 /* prompt the user to press one of the `allowed' keys;
@@ -1283,7 +2277,8 @@ char read_key(const char* prompt, const char* allowed)
     mvprintw(LINES - 1, 0, "%s", prompt);
     int col = strlen(prompt);
     while(true) {
-        int c = mvgetch(LINES - 1, col);
+        move(LINES - 1, col);
+        int c = getkey();
         switch(c) {
             case 3:
             case 7:
@@ -1300,6 +2295,23 @@ char read_key(const char* prompt, const char* allowed)
     }
 }
 
+/* shows how far along a long command is. Returns 0 if ESC, ^C or ^G was
+   pressed since the last call, i.e. the command should stop */
+int progress(const char* what, size_t done, size_t total)
+{
+    mvhline(LINES - 1, 0, ' ', COLS);
+    mvprintw(LINES - 1, 0, "%s... %d%%, ESC cancels", what,
+            total ? (int)((double)done * 100.0 / (double)total) : 100);
+    refresh();
+    int c, go = 1;
+    nodelay(stdscr, TRUE);
+    while((c = getch()) != ERR) {
+        if(c == 27 || c == 3 || c == 7) go = 0;
+    }
+    nodelay(stdscr, FALSE);
+    return go;
+}
+
 /* prompt the user to input a string, terminated by LF or CR.
    the ending CR and/or LF are discarded.
    returns NULL if the prompt was cancelled with ^C, ^G, ESC */
@@ -1314,7 +2326,8 @@ char* read_string(const char* prompt)
     int col = strlen(prompt);
     int out = 0;
     while(!out) {
-        int c = mvgetch(LINES - 1, col + nbuf);
+        move(LINES - 1, col + nbuf);
+        int c = getkey();
         switch(c) {
             case 3:
             case 7:
@@ -1364,7 +2377,8 @@ char* read_filename(void)
     int col = 0;
     int out = 0;
     while(!out) {
-        int c = mvgetch(LINES - 1, col + nbuf);
+        move(LINES - 1, col + nbuf);
+        int c = getkey();
         switch(c) {
             case 3:
             case 7:
@@ -1410,6 +2424,10 @@ void save_file(void)
     free(fname);
     fname = strdup(buf);
 
+    // only rewrite what changed if the file is still the one we loaded
+    int inplace = write_changed_blocks(buf);
+    if(inplace != 0) goto end1;
+
     FILE* f = fopen(buf, "wb");
     if(!f) {
         mvhline(LINES - 1, 0, ' ', COLS);
@@ -1417,8 +2435,12 @@ void save_file(void)
         goto end1;
     }
 
+    struct probe p = probe_begin(STAT_WRITE);
     size_t written = fwrite(mem, 1, memsize, f);
-    if(written == memsize) {
+    p.bytes = written;
+    probe_end(p);
+    if(written == memsize && fflush(f) == 0) {
+        file_saved(fileno(f));
         mvhline(LINES - 1, 0, ' ', COLS);
         mvprintw(LINES - 1, 0, "Wrote %zd bytes", written);
     } else {
@@ -1435,6 +2457,100 @@ end1:
     free(buf);
 }
 
+struct block_writer {
+    int fd;
+    size_t written;
+    int err;
+};
+
+static void write_block(size_t b, void* ctx)
+{
+    struct block_writer* w = ctx;
+    size_t bs = merkle_block_size();
+    size_t from = b * bs;
+    if(w->err || from >= memsize) return;
+    size_t n = (memsize - from < bs) ? memsize - from : bs;
+    while(n) {
+        ssize_t r = pwrite(w->fd, mem + from, n, (off_t)from);
+        if(r < 0) {
+            if(errno == EINTR) continue;
+            w->err = errno;
+            return;
+        }
+        from += (size_t)r;
+        n -= (size_t)r;
+        w->written += (size_t)r;
+    }
+}
+
+/* if `path' is the file merkleDisk describes and nobody touched it since,
+   writes just the blocks which changed since then. Returns 1 if it did,
+   -1 if that failed, and 0 if the whole file needs writing */
+int write_changed_blocks(const char* path)
+{
+    struct stat sb;
+    if(!merkleDisk || !merkle_sync()) return 0;
+    // check the file we're about to write to, not whatever's at path now
+    int fd = open(path, O_WRONLY);
+    if(fd == -1) return 0;
+    if(fstat(fd, &sb) == -1 || !unchanged_since(&sb)
+            || (size_t)sb.st_size != merkle_size(merkleDisk)) {
+        close(fd);
+        return 0;
+    }
+
+    struct probe p = probe_begin(STAT_WRITE);
+    struct block_writer w = { fd, 0, 0 };
+    merkle_diff(merkle, merkleDisk, write_block, &w);
+    if(!w.err && ftruncate(fd, (off_t)memsize) == -1) w.err = errno;
+    if(!w.err) file_saved(fd);
+    if(close(fd) == -1 && !w.err) w.err = errno;
+    p.bytes = w.written;
+    probe_end(p);
+
+    if(w.err) {
+        merkle_free(merkleDisk);
+        merkleDisk = NULL;
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Failed to write %s: %s", path, strerror(w.err));
+        return -1;
+    }
+    mvhline(LINES - 1, 0, ' ', COLS);
+    mvprintw(LINES - 1, 0, "Wrote %zd bytes, %zu of which changed", memsize, w.written);
+    return 1;
+}
+
+/* whether the file sb describes is the one merkleDisk describes, and
+   nobody touched it since. Timestamps have to match to the nanosecond;
+   on file systems which only keep seconds we can't tell, so it's no */
+int unchanged_since(const struct stat* sb)
+{
+    if(sb->st_dev != diskStat.st_dev || sb->st_ino != diskStat.st_ino) return 0;
+    if(sb->st_mtim.tv_sec != diskStat.st_mtim.tv_sec
+            || sb->st_mtim.tv_nsec != diskStat.st_mtim.tv_nsec
+            || sb->st_ctim.tv_sec != diskStat.st_ctim.tv_sec
+            || sb->st_ctim.tv_nsec != diskStat.st_ctim.tv_nsec) {
+        return 0;
+    }
+    return sb->st_mtim.tv_nsec != 0 || sb->st_ctim.tv_nsec != 0;
+}
+
+/* the buffer is now what's in the file open as fd */
+void file_saved(int fd)
+{
+    // nothing's modified anymore
+    dirty_free(dirty);
+    dirty = NULL;
+    paintedLines = 0;
+    repaint();
+
+    merkle_free(merkleDisk);
+    merkleDisk = NULL;
+    if(merkle_sync() && fstat(fd, &diskStat) == 0) {
+        merkleDisk = merkle_copy(merkle);
+    }
+}
+
 void open_file2(FILE** f, ssize_t* sz)
 {
     *f = NULL;
@@ -1479,7 +2595,15 @@ void open_file1(void)
     unsigned char* newmem = malloc(sz);
     if(!newmem) abort();
 
+    // what the file was before we read it; if it changes while we do,
+    // it won't match when it's time to write it back
+    struct stat sb;
+    int haveStat = fstat(fileno(f), &sb) == 0;
+
+    struct probe p = probe_begin(STAT_READ);
     size_t haveread = fread(newmem, 1, sz, f);
+    p.bytes = haveread;
+    probe_end(p);
 
     fclose(f);
 
@@ -1492,6 +2616,22 @@ void open_file1(void)
     memcapacity = sz;
     memoffset = 0;
     windowOffset = 0;
+    dirty_free(dirty);
+    dirty = NULL;
+    mem_changed(0, SIZE_MAX);
+
+    // what the file looks like, for C and for writing it back
+    merkle_free(merkle);
+    merkle_free(merkleDisk);
+    merkle_free(merkleCheckpoint);
+    merkleDisk = merkleCheckpoint = NULL;
+    merkle = merkle_build(mem, memsize);
+    merkleStaleFrom = SIZE_MAX;
+    merkleStaleTo = 0;
+    if(merkle && haveStat) {
+        diskStat = sb;
+        merkleDisk = merkle_copy(merkle);
+    }
     redraw();
 
     mvhline(LINES - 1, 0, ' ', COLS);
@@ -1535,12 +2675,17 @@ void insert_file(size_t before)
 
     insert_n_nulls(before, sz);
 
+    struct probe p = probe_begin(STAT_READ);
     size_t haveread = fread(mem + before, 1, sz, f);
+    p.bytes = haveread;
+    probe_end(p);
 
     fclose(f);
     free(buf);
 
-    redraw();
+    repaint();
+    update_details();
+    update_status();
 
     mvhline(LINES - 1, 0, ' ', COLS);
     mvprintw(LINES - 1, 0, "Read %zd bytes", haveread);
@@ -1592,95 +2737,588 @@ void advance_offset(long sign)
     update_status();
 }
 
-void continue_find_cb(
-        unsigned char* from, size_t nfrom,
-        enum SEARCH_DIRECTION direction)
+/* jumps to the next (dir > 0) or previous invalid UTF-8 sequence and says
+   what's wrong with it */
+void find_invalid_utf8(int dir)
 {
-    if(!nSearchString || !searchString) return;
+    if(memsize == 0) return;
+    const char* why = NULL;
+    struct probe p = probe_begin(STAT_SEARCH);
+    size_t at = (dir > 0)
+        ? utf8_next_invalid(mem, memsize, memoffset + 1, &why)
+        : utf8_prev_invalid(mem, memsize, memoffset, &why);
+    p.bytes = (dir > 0)
+        ? ((at < memsize) ? at : memsize) - memoffset
+        : memoffset - ((at < memsize) ? at : 0);
+    probe_end(p);
+
+    if(at >= memsize) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "No invalid UTF-8 %s the cursor",
+                (dir > 0) ? "after" : "before");
+        return;
+    }
 
-    unsigned char* p = NULL;
-    unsigned lutkey = ((searchStringMask != NULL) << 1)
-                    | (direction == BACKWARDS)
-                    ;
+    memoffset = at;
+    lownibble = 0;
+    adjust_screen();
+    update_details();
+    mvhline(LINES - 1, 0, ' ', COLS);
+    mvprintw(LINES - 1, 0, "Invalid UTF-8 at %zx: %s", at, why);
+}
 
-    switch(lutkey)
-    {
-        case 0:
-            p = memsearch(from, nfrom,
-                          searchString, nSearchString);
-            break;
-        case 1:
-            p = rmemsearch(from, nfrom,
-                           searchString, nSearchString);
-            break;
-        case 2:
-            p = bpatmemsearch(from, nfrom,
-                              searchString, nSearchString, searchStringMask);
-            break;
-        case 3:
-            p = bpatrmemsearch(from, nfrom,
-                               searchString, nSearchString, searchStringMask);
-            break;
+/* jumps to the next (dir > 0) or previous byte which was modified since
+   the file was opened or last saved */
+void find_modified(int dir)
+{
+    if(memsize == 0) return;
+    size_t at = SIZE_MAX;
+    if(dirty) {
+        at = (dir > 0) ? dirty_next(dirty, memoffset + 1)
+                       : dirty_prev(dirty, memoffset);
+    }
+    if(at == SIZE_MAX) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "No modified bytes %s the cursor",
+                (dir > 0) ? "after" : "before");
+        return;
     }
+    memoffset = at;
+    lownibble = 0;
+    adjust_screen();
+    update_details();
+    update_status();
+}
 
-    if(p) {
-        memoffset = p - mem;
-        adjust_screen();
-        update_details();
+/* is byte i of the buffer different from the byte it goes with in the
+   other file? Bytes without a partner count as different */
+int differs(size_t i)
+{
+    long j = (long)i + sync_delta(diffSync, i, NULL, NULL);
+    return j < 0 || (size_t)j >= diffSize || mem[i] != diffMem[j];
+}
+
+/* starts comparing the buffer against another file, which gets mapped
+   read only; or stops, if we're already at it */
+void diff_open(void)
+{
+    if(diffSync) {
+        if(diffSize) munmap(diffMem, diffSize);
+        sync_free(diffSync);
+        diffSync = NULL;
+        diffMem = NULL;
+        diffSize = 0;
+        diffLearned = 0;
+        paintedLines = 0;
+        repaint();
         update_status();
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Stopped comparing");
+        return;
+    }
+
+    char* name = read_filename();
+    update_status();
+    if(!name) return;
+
+    const char* error = NULL;
+    int fd = open(name, O_RDONLY);
+    struct stat sb;
+    if(fd == -1 || -1 == fstat(fd, &sb)) {
+        error = strerror(errno);
+    } else if(!S_ISREG(sb.st_mode)) {
+        // same reasoning as open_file2: files only
+        error = "this is not a file!";
     } else {
+        diffSize = sb.st_size;
+        if(diffSize) {
+            diffMem = mmap(NULL, diffSize, PROT_READ, MAP_SHARED, fd, 0);
+            if(diffMem == MAP_FAILED) {
+                error = strerror(errno);
+                diffMem = NULL;
+                diffSize = 0;
+            } else {
+                posix_madvise(diffMem, diffSize, POSIX_MADV_SEQUENTIAL);
+            }
+        }
+    }
+    if(fd != -1) close(fd);
+    if(!error) {
+        diffSync = sync_new();
+        if(!diffSync) abort();
+    }
+
+    if(error) {
         mvhline(LINES - 1, 0, ' ', COLS);
-        mvprintw(LINES - 1, 0, "Not found");
+        mvprintw(LINES - 1, 0, "Failed to open %s: %s", name, error);
+    } else {
+        paintedLines = 0;
+        repaint();
+        update_status();
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Comparing with %s (%zu bytes)", name, diffSize);
     }
+    free(name);
 }
 
-void save_search_string(void* s, size_t len, void* mask)
+// first difference at or after i, or memsize. Places where bytes were
+// inserted or deleted count too, even if they line up on both sides
+static size_t next_difference(size_t i)
 {
-    unsigned char* tosave = s;
-    unsigned char* masktosave = mask;
-    nSearchString = len;
-    free(searchString);
-    free(searchStringMask);
+    while(i < memsize) {
+        size_t until;
+        long j = (long)i + sync_delta(diffSync, i, NULL, &until);
+        if(j < 0 || (size_t)j >= diffSize) return i;
+        size_t n = memsize - i;
+        if(n > diffSize - (size_t)j) n = diffSize - (size_t)j;
+        if(n > until - i) n = until - i;
+        size_t k = scan_cmp(mem + i, diffMem + j, n);
+        i += k;
+        if(k < n || i == until) return i;
+    }
+    return memsize;
+}
 
-    if(nSearchString == 0) return;
+// last difference before i, or SIZE_MAX; see next_difference()
+static size_t last_difference(size_t i)
+{
+    while(i > 0) {
+        size_t from;
+        long j = (long)(i - 1) + sync_delta(diffSync, i - 1, &from, NULL);
+        if(j < 0 || (size_t)j >= diffSize) return i - 1;
+        size_t n = i - from;
+        if(n > (size_t)j + 1) n = (size_t)j + 1;
+        size_t k = scan_rcmp(mem + i - n, diffMem + (size_t)j + 1 - n, n);
+        if(k < n) return i - 1 - k;
+        i -= n;
+        if(i == from && from > 0) return from;
+    }
+    return SIZE_MAX;
+}
 
-    searchString = malloc(nSearchString);
-    if(!searchString) {
-        // ignore the malloc error, it's fine to not save it
-        nSearchString = 0;
+// the sync table only learns about inserted or deleted bytes when going
+// forwards over them; catch up to i before looking around there
+static void diff_learn(size_t i)
+{
+    size_t at = diffLearned;
+    if(at >= i) return;
+    while(at < i) {
+        at = next_difference(at);
+        if(at >= i) break;
+        sync_resync(diffSync, mem, memsize, diffMem, diffSize, at);
+        while(at < memsize && differs(at)) ++at;
+    }
+    diffLearned = at;
+    paintedLines = 0;
+}
+
+/* jumps to the start of the next (dir > 0) or previous stretch of bytes
+   which differ from the other file */
+void diff_jump(int dir)
+{
+    if(!diffSync) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Not comparing with anything; see D");
         return;
+    }
+    if(memsize == 0) return;
+
+    struct probe p = probe_begin(STAT_SEARCH);
+    diff_learn(memoffset);
+    size_t at = memoffset;
+    if(dir > 0) {
+        // get past the difference we're on
+        while(at < memsize && differs(at)) ++at;
+        at = next_difference(at);
+        // maybe bytes got inserted or deleted here; if so, the bytes
+        // after this line up with the other file somewhere else
+        if(at < memsize) {
+            sync_resync(diffSync, mem, memsize, diffMem, diffSize, at);
+            if(at > diffLearned) diffLearned = at;
+            paintedLines = 0;
+        }
+        p.bytes = at - memoffset;
     } else {
-        memcpy(searchString, tosave, len);
+        // back to the start of the difference we're in, if we're in one
+        if(at > 0 && differs(at) && differs(at - 1)) {
+            while(at > 0 && differs(at - 1)) --at;
+        } else {
+            at = last_difference(at);
+            if(at != SIZE_MAX) {
+                while(at > 0 && differs(at - 1)) --at;
+            }
+        }
+        p.bytes = (at != SIZE_MAX) ? memoffset - at : memoffset;
     }
-    if(masktosave) {
-        searchStringMask = malloc(nSearchString);
-        if(!searchStringMask) {
-            // ignore the malloc, error, it's fine to not save it
-            nSearchString = 0;
-            // and empty out the base search string
-            free(searchString);
-            // ...and NULL it
-            searchString = NULL;
+    probe_end(p);
+
+    if(at >= memsize) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        if(dir > 0) {
+            long j = (long)memsize + sync_delta(diffSync, memsize, NULL, NULL);
+            if(j >= 0 && (size_t)j < diffSize)
+                mvprintw(LINES - 1, 0, "No more differences, but the other file goes on for %zu bytes",
+                        diffSize - (size_t)j);
+            else
+                mvprintw(LINES - 1, 0, "No more differences");
         } else {
-            memcpy(searchStringMask, masktosave, len);
+            mvprintw(LINES - 1, 0, "No differences before the cursor");
         }
+        return;
     }
+
+    memoffset = at;
+    lownibble = 0;
+    adjust_screen();
+    update_details();
+    mvhline(LINES - 1, 0, ' ', COLS);
+    long j = (long)at + sync_delta(diffSync, at, NULL, NULL);
+    if(j < 0 || (size_t)j >= diffSize)
+        mvprintw(LINES - 1, 0, "Not in the other file");
+    else if(differs(at))
+        mvprintw(LINES - 1, 0, "Differs from %zx in the other file", (size_t)j);
+    else
+        mvprintw(LINES - 1, 0, "Lines up with %zx in the other file, after a gap", (size_t)j);
 }
 
-/* implementation of find forwards/backwards. Uses memsearch/rmemsearch.
-   updates memoffset if anything is found. This does not loop around.  */
-void find_cb(
-        unsigned char* from, size_t nfrom,
-        enum SEARCH_DIRECTION direction)
+/* brings the hash tree of the buffer up to date, building it if need be.
+   Returns 0 if we ran out of memory */
+int merkle_sync(void)
 {
-    if(memsize == 0) return;
-    char* s = read_string("? ");
+    if(!merkle) {
+        merkle = merkle_build(mem, memsize);
+    } else if(merkleStaleFrom < merkleStaleTo) {
+        if(!merkle_update(merkle, mem, memsize, merkleStaleFrom, merkleStaleTo)) {
+            merkle_free(merkle);
+            merkle = NULL;
+        }
+    }
+    merkleStaleFrom = SIZE_MAX;
+    merkleStaleTo = 0;
+    return merkle != NULL;
+}
 
-    if(!s || !*s) return;
+// stretches of changed blocks, in bytes
+struct changes {
+    size_t* from;
+    size_t* to;
+    size_t n, cap;
+};
 
-    if(s[0] == 't') {
-        save_search_string(s+1, strlen(s) - 1, NULL);
-        continue_find_cb(from, nfrom, direction);
+static void collect_block(size_t b, void* ctx)
+{
+    struct changes* c = ctx;
+    size_t bs = merkle_block_size();
+    if(c->n && c->to[c->n - 1] == b * bs) {
+        c->to[c->n - 1] += bs;
+        return;
+    }
+    if(c->n >= c->cap) {
+        c->cap = c->cap ? c->cap * 2 : 64;
+        c->from = realloc(c->from, c->cap * sizeof(size_t));
+        c->to = realloc(c->to, c->cap * sizeof(size_t));
+        if(!c->from || !c->to) abort();
+    }
+    c->from[c->n] = b * bs;
+    c->to[c->n] = (b + 1) * bs;
+    c->n++;
+}
+
+static void change_row(size_t i, char* buf, size_t nbuf, void* ctx)
+{
+    struct changes* c = ctx;
+    size_t to = (c->to[i] < memsize) ? c->to[i] : memsize;
+    if(c->from[i] >= memsize) {
+        snprintf(buf, nbuf, "%016zx  cut off", c->from[i]);
+    } else {
+        snprintf(buf, nbuf, "%016zx-%016zx  %zu KiB",
+                c->from[i], to - 1, (to - c->from[i] + 1023) / 1024);
+    }
+}
+
+/* compares the buffer with the file as it was loaded or last written, or
+   with the checkpoint, a block at a time, or sets the checkpoint. Lists
+   the stretches which changed; ENTER jumps to one */
+void compare_blocks(void)
+{
+    char c = read_key("Compare with d)isk or c)heckpoint, or s)et the checkpoint? ", "dcs");
+    if(!c) return;
+    if(!merkle_sync()) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Not enough memory to hash the buffer");
+        return;
+    }
+
+    if(c == 's') {
+        merkle_free(merkleCheckpoint);
+        merkleCheckpoint = merkle_copy(merkle);
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, merkleCheckpoint ? "Checkpoint set" : "Not enough memory for a checkpoint");
+        return;
+    }
+
+    void* against = (c == 'd') ? merkleDisk : merkleCheckpoint;
+    const char* what = (c == 'd') ? "the file on disk" : "the checkpoint";
+    if(!against) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, (c == 'd')
+                ? "Don't know what's on disk; write the file first"
+                : "No checkpoint; s sets one");
+        return;
+    }
+
+    struct changes ch = { NULL, NULL, 0, 0 };
+    struct probe p = probe_begin(STAT_SEARCH);
+    size_t nblocks = merkle_diff(merkle, against, collect_block, &ch);
+    probe_end(p);
+    if(nblocks == 0) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Same as %s", what);
+        return;
+    }
+
+    // start at the first change which isn't behind the cursor
+    size_t sel = 0;
+    while(sel + 1 < ch.n && ch.to[sel] <= memoffset) ++sel;
+
+    size_t bs = merkle_block_size();
+    size_t total = (memsize > merkle_size(against)) ? memsize : merkle_size(against);
+    char title[128];
+    snprintf(title, sizeof(title), "%zu of %zu %zuKiB blocks differ from %s",
+            nblocks, (total + bs - 1) / bs, bs / 1024, what);
+    if(browse_list(title, ch.n, change_row, &ch, NULL, &sel) == '\n' && memsize) {
+        memoffset = (ch.from[sel] < memsize) ? ch.from[sel] : memsize - 1;
+        lownibble = 0;
+        adjust_window();
+    }
+    free(ch.from);
+    free(ch.to);
+    redraw();
+}
+
+/* jumps to the next (dir > 0) or previous byte which differs from the
+   byte under the cursor or, if prompt is set, from a byte the user types
+   in; i.e. skips over padding */
+void skip_run(int dir, int prompt)
+{
+    if(memsize == 0) return;
+    unsigned char b = mem[memoffset];
+    if(prompt) {
+        char* s = read_string("Skip byte (hex): ");
+        update_status();
+        if(!s) return;
+        unsigned v = 256;
+        sscanf(s, "%x", &v);
+        free(s);
+        if(v > 255) {
+            mvhline(LINES - 1, 0, ' ', COLS);
+            mvprintw(LINES - 1, 0, "Not a byte");
+            return;
+        }
+        b = v;
+    }
+
+    size_t at;
+    if(dir > 0) {
+        size_t n = memsize - memoffset - 1;
+        size_t k = scan_skip(mem + memoffset + 1, n, b);
+        if(k == n) goto notfound;
+        at = memoffset + 1 + k;
+    } else {
+        size_t k = scan_rskip(mem, memoffset, b);
+        if(k == memoffset) goto notfound;
+        at = memoffset - 1 - k;
+    }
+
+    memoffset = at;
+    lownibble = 0;
+    adjust_screen();
+    update_details();
+    update_status();
+    return;
+
+notfound:
+    mvhline(LINES - 1, 0, ' ', COLS);
+    mvprintw(LINES - 1, 0, "Nothing but %02x %s the cursor", b,
+            (dir > 0) ? "after" : "before");
+}
+
+struct run {
+    size_t offset;
+    size_t length;
+    unsigned char byte;
+};
+struct runs {
+    struct run* v;
+    size_t n, cap;
+};
+// stop collecting runs after this many; nobody's scrolling through more
+#define MAX_RUNS (1u << 20)
+
+static int collect_run(size_t offset, size_t length, unsigned char b, void* ctx)
+{
+    struct runs* r = ctx;
+    if(r->n >= r->cap) {
+        r->cap = r->cap ? r->cap * 2 : 1024;
+        r->v = realloc(r->v, r->cap * sizeof(struct run));
+        if(!r->v) abort();
+    }
+    r->v[r->n].offset = offset;
+    r->v[r->n].length = length;
+    r->v[r->n].byte = b;
+    r->n++;
+    return r->n < MAX_RUNS;
+}
+
+static void run_row(size_t i, char* buf, size_t nbuf, void* ctx)
+{
+    struct run* r = &((struct runs*)ctx)->v[i];
+    snprintf(buf, nbuf, "%016zx  %02x x %zu", r->offset, r->byte, r->length);
+}
+
+/* prompts for a length and lists all runs of identical bytes at least
+   that long; ENTER jumps to the start of one */
+void list_runs(void)
+{
+    if(memsize == 0) return;
+    char* s = read_string("Minimum run length: ");
+    update_status();
+    if(!s) return;
+    long minlen = 0;
+    sscanf(s, "%li", &minlen);
+    free(s);
+    if(minlen < 2) minlen = 2;
+
+    struct runs r = { NULL, 0, 0 };
+    scan_runs(mem, memsize, (size_t)minlen, collect_run, &r);
+    if(r.n == 0) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "No runs of %ld or more identical bytes", minlen);
+        return;
+    }
+
+    // start at the first run which isn't behind the cursor
+    size_t sel = 0;
+    while(sel + 1 < r.n && r.v[sel].offset + r.v[sel].length <= memoffset) ++sel;
+
+    char title[128];
+    snprintf(title, sizeof(title), "%zu%s runs of %ld or more identical bytes",
+            r.n, (r.n >= MAX_RUNS) ? "+" : "", minlen);
+    if(browse_list(title, r.n, run_row, &r, NULL, &sel) == '\n') {
+        memoffset = r.v[sel].offset;
+        lownibble = 0;
+        adjust_window();
+    }
+    free(r.v);
+    redraw();
+}
+
+void continue_find_cb(
+        unsigned char* from, size_t nfrom,
+        enum SEARCH_DIRECTION direction)
+{
+    if(!nSearchString || !searchString) return;
+
+    unsigned char* p = NULL;
+    unsigned lutkey = ((searchStringMask != NULL) << 1)
+                    | (direction == BACKWARDS)
+                    ;
+
+    struct probe probe = probe_begin(STAT_SEARCH);
+    switch(lutkey)
+    {
+        case 0:
+            p = memsearch(from, nfrom,
+                          searchString, nSearchString);
+            break;
+        case 1:
+            p = rmemsearch(from, nfrom,
+                           searchString, nSearchString);
+            break;
+        case 2:
+            p = bpatmemsearch(from, nfrom,
+                              searchString, nSearchString, searchStringMask);
+            break;
+        case 3:
+            p = bpatrmemsearch(from, nfrom,
+                               searchString, nSearchString, searchStringMask);
+            break;
+    }
+    // how far we had to look
+    if(!p) probe.bytes = nfrom;
+    else if(direction == FORWARDS) probe.bytes = p - from + nSearchString;
+    else probe.bytes = from + nfrom - p;
+    probe_end(probe);
+
+    if(p) {
+        memoffset = p - mem;
+        adjust_screen();
+        update_details();
+        update_status();
+    } else {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Not found");
+    }
+}
+
+void save_search_string(void* s, size_t len, void* mask)
+{
+    unsigned char* tosave = s;
+    unsigned char* masktosave = mask;
+    nSearchString = len;
+    free(searchString);
+    free(searchStringMask);
+    searchString = NULL;
+    searchStringMask = NULL;
+
+    if(nSearchString == 0) return;
+
+    searchString = malloc(nSearchString);
+    if(!searchString) {
+        // ignore the malloc error, it's fine to not save it
+        nSearchString = 0;
+        return;
+    } else {
+        memcpy(searchString, tosave, len);
+    }
+    if(masktosave) {
+        searchStringMask = malloc(nSearchString);
+        if(!searchStringMask) {
+            // ignore the malloc, error, it's fine to not save it
+            nSearchString = 0;
+            // and empty out the base search string
+            free(searchString);
+            // ...and NULL it
+            searchString = NULL;
+        } else {
+            memcpy(searchStringMask, masktosave, len);
+        }
+    }
+}
+
+/* parses a search string in the syntax described in HELP ("find syntax").
+   On success, returns 1 and malloc's *pneedle (and *pmask for bit
+   patterns; NULL otherwise), which the caller must free.
+   Returns 0 if the string is malformed. */
+int parse_search_string(
+        const char* s,
+        unsigned char** pneedle, size_t* pnneedle,
+        unsigned char** pmask)
+{
+    *pneedle = NULL;
+    *pnneedle = 0;
+    *pmask = NULL;
+
+    if(!s || !*s) return 0;
+
+    if(s[0] == 't') {
+        size_t len = strlen(s) - 1;
+        if(len == 0) return 0;
+        *pneedle = malloc(len);
+        if(!*pneedle) abort();
+        memcpy(*pneedle, s + 1, len);
+        *pnneedle = len;
+        return 1;
     } else if(s[0] == 'm') {
         // x or . is "don't care" (mask 0);
         // 0 is 0 (mask 1);
@@ -1691,7 +3329,7 @@ void find_cb(
         unsigned char* needle = malloc(1024);
         size_t cneedle = 1024, sneedle = 0;
         unsigned char* mask = malloc(1024);
-        char* p = s + 1, *end = s + strlen(s);
+        const char* p = s + 1, *end = s + strlen(s);
         size_t nbits = 0;
         do {
             while(*p == ' ' || *p == '\t') ++p;
@@ -1713,10 +3351,13 @@ void find_cb(
                 mask[sneedle] <<= 1;
                 mask[sneedle] &= 0xFEu;
                 nbits++;
+            } else if(*p == '\0') {
+                // trailing whitespace
+                break;
             } else {
                 free(needle);
                 free(mask);
-                goto invalid_format;
+                return 0;
             }
             if(nbits >= 8) {
                 sneedle++;
@@ -1747,27 +3388,36 @@ void find_cb(
             }
             sneedle++;
         }
-        save_search_string(needle, sneedle, mask);
-        continue_find_cb(from, nfrom, direction);
+        if(sneedle == 0) {
+            free(needle);
+            free(mask);
+            return 0;
+        }
+        *pneedle = needle;
+        *pnneedle = sneedle;
+        *pmask = mask;
+        return 1;
     } else {
         unsigned char* needle = malloc(1024);
         size_t cneedle = 1024, sneedle = 0;
-        char* p = s, *end = s + strlen(s);
+        const char* p = s, *end = s + strlen(s);
         do {
             while(*p == ' ' || *p == '\t') ++p;
+            // trailing whitespace
+            if(*p == '\0') break;
             // should be able to grab two chars
-            if(*p != '\0' && p >= end - 1) {
+            if(p >= end - 1) {
                 free(needle);
-                goto invalid_format;
+                return 0;
             }
             char c1 = *p, c2 = *(p + 1);
             p += 2;
             char *pc1 = strchr(HEX, tolower(c1));
             char *pc2 = strchr(HEX, tolower(c2));
-            if(!pc1 || !pc2)
+            if(!pc1 || !pc2 || !*pc1 || !*pc2)
             {
                 free(needle);
-                goto invalid_format;
+                return 0;
             }
             unsigned char uc1 = pc1 - HEX;
             unsigned char uc2 = pc2 - HEX;
@@ -1782,16 +3432,43 @@ void find_cb(
             needle[sneedle++] = (uc1 << 4) | uc2;
         } while(p < end);
 
-        save_search_string(needle, sneedle, NULL);
-        continue_find_cb(from, nfrom, direction);
+        if(sneedle == 0) {
+            free(needle);
+            return 0;
+        }
+        *pneedle = needle;
+        *pnneedle = sneedle;
+        return 1;
     }
+}
 
-    return;
+/* implementation of find forwards/backwards. Uses memsearch/rmemsearch.
+   updates memoffset if anything is found. This does not loop around.  */
+void find_cb(
+        unsigned char* from, size_t nfrom,
+        enum SEARCH_DIRECTION direction)
+{
+    if(memsize == 0) return;
+    char* s = read_string("? ");
 
-invalid_format:
-    mvhline(LINES - 1, 0, ' ', COLS);
-    mvprintw(LINES - 1, 0, "Invalid format");
+    if(!s) return;
+
+    unsigned char* needle = NULL;
+    unsigned char* mask = NULL;
+    size_t nneedle = 0;
+    int ok = parse_search_string(s, &needle, &nneedle, &mask);
     free(s);
+
+    if(!ok) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Invalid format");
+        return;
+    }
+
+    save_search_string(needle, nneedle, mask);
+    free(needle);
+    free(mask);
+    continue_find_cb(from, nfrom, direction);
 }
 
 /* prompts the user for a string and searches for the next occurrence.
@@ -1822,6 +3499,379 @@ void find_backward(int prompt)
         return continue_find_cb(from, nfrom, BACKWARDS);
 }
 
+// find_all() searches this much at a time, between progress updates
+#define SEARCH_BATCH (64ul << 20)
+
+struct hits {
+    size_t* v;
+    size_t n, cap;
+};
+
+/* finds every occurrence of needle (with mask, if not NULL) in bytes
+   [a1, a2] and appends where they start to h. After a hit the search
+   starts over, so hits don't overlap. Returns 0 if it was cancelled */
+static int find_all(unsigned char* needle, size_t nneedle, unsigned char* mask,
+        size_t a1, size_t a2, struct hits* h)
+{
+    void* st = mask ? bpatmemsearch_begin(needle, nneedle, mask)
+                    : memsearch_begin(needle, nneedle);
+    if(!st) abort();
+    struct probe p = probe_begin(STAT_SEARCH);
+    for(size_t at = a1; at <= a2; ) {
+        size_t len = (a2 + 1 - at < SEARCH_BATCH) ? a2 + 1 - at : SEARCH_BATCH;
+        size_t off = 0;
+        while(off < len) {
+            size_t consumed;
+            unsigned char* hit = memsearch_feed(st, mem + at + off, len - off, &consumed);
+            off += consumed;
+            if(!hit) break;
+            if(h->n >= h->cap) {
+                h->cap = h->cap ? h->cap * 2 : 1024;
+                h->v = realloc(h->v, h->cap * sizeof(size_t));
+                if(!h->v) abort();
+            }
+            h->v[h->n++] = at + off - nneedle;
+            memsearch_reset(st);
+        }
+        at += len;
+        if(at <= a2 && !progress("Searching", at - a1, a2 + 1 - a1)) {
+            p.bytes = at - a1;
+            probe_end(p);
+            memsearch_end(st);
+            return 0;
+        }
+    }
+    p.bytes = a2 + 1 - a1;
+    probe_end(p);
+    memsearch_end(st);
+    return 1;
+}
+
+// the number of hits which end at or before x
+static size_t hits_before(const struct hits* h, size_t x, size_t nold)
+{
+    size_t lo = 0, hi = h->n;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(h->v[mid] + nold <= x) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// where byte x goes after replacing the nold bytes at each of the hits
+// with nnew bytes; bytes in a hit go to the start of its replacement
+static size_t remap_offset(size_t x, const struct hits* h, size_t nold, size_t nnew)
+{
+    size_t k = hits_before(h, x, nold);
+    if(k < h->n && h->v[k] <= x) x = h->v[k];
+    return x - k * nold + k * nnew;
+}
+
+/* asks for a pattern, a replacement and a region, and replaces every
+   occurrence of the pattern in that region. The hits are found first,
+   then the buffer is rebuilt in one pass, so every byte moves at most
+   once however many hits there are */
+void replace_all(void)
+{
+    if(memsize == 0) return;
+    char* s = read_string("Replace all: ");
+    update_status();
+    if(!s) return;
+    unsigned char* needle = NULL;
+    unsigned char* mask = NULL;
+    size_t nneedle = 0;
+    int ok = parse_search_string(s, &needle, &nneedle, &mask);
+    free(s);
+    unsigned char* with = NULL;
+    size_t nwith = 0;
+    struct hits h = { NULL, 0, 0 };
+    if(!ok) goto invalid;
+
+    // a lone t is no text at all, i.e. delete the hits
+    s = read_string("With (t alone deletes): ");
+    update_status();
+    if(!s) goto end;
+    unsigned char* wmask = NULL;
+    ok = (strcmp(s, "t") == 0) || parse_search_string(s, &with, &nwith, &wmask);
+    free(s);
+    free(wmask);
+    if(!ok || wmask) goto invalid;
+
+    char over = read_key("In the w)hole buffer or between m)arkers? ", "wm");
+    if(!over) goto end;
+    size_t a1 = 0, a2 = memsize - 1;
+    if(over == 'm') {
+        if(!read_pair_of_markers(&a1, &a2)) goto end;
+        if(a2 >= memsize) a2 = memsize - 1;
+        if(a1 > a2) a1 = a2;
+    }
+
+    if(!find_all(needle, nneedle, mask, a1, a2, &h)) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Cancelled; nothing was replaced");
+        goto end;
+    }
+    if(h.n == 0) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Not found");
+        goto end;
+    }
+
+    size_t first = h.v[0];
+    size_t newsize = memsize - h.n * nneedle + h.n * nwith;
+    if(nwith == nneedle) {
+        for(size_t k = 0; k < h.n; ++k) {
+            memcpy(mem + h.v[k], with, nwith);
+            mem_changed(h.v[k], h.v[k] + nwith);
+        }
+        goto done;
+    }
+
+    // which bytes were modified moves along with them
+    void* newdirty = NULL;
+    if(dirty && (newdirty = dirty_new(newsize))) {
+        copy_dirty(newdirty, 0, 0, first);
+        for(size_t k = 0; k < h.n; ++k) {
+            size_t src = h.v[k] + nneedle;
+            size_t next = (k + 1 < h.n) ? h.v[k + 1] : memsize;
+            copy_dirty(newdirty, remap_offset(src, &h, nneedle, nwith), src, next - src);
+        }
+    }
+
+    if(nwith < nneedle) {
+        // everything moves down; go front to back
+        size_t dst = first;
+        for(size_t k = 0; k < h.n; ++k) {
+            memcpy(mem + dst, with, nwith);
+            dst += nwith;
+            size_t src = h.v[k] + nneedle;
+            size_t next = (k + 1 < h.n) ? h.v[k + 1] : memsize;
+            memmove(mem + dst, mem + src, next - src);
+            dst += next - src;
+        }
+    } else {
+        // everything moves up; go back to front
+        if(memcapacity < newsize) {
+            grow_vector(&mem, newsize);
+            if(!mem) abort();
+            memcapacity = newsize;
+        }
+        size_t d = nwith - nneedle;
+        size_t end = memsize;
+        for(size_t k = h.n; k-- > 0; ) {
+            size_t src = h.v[k] + nneedle;
+            memmove(mem + src + (k + 1) * d, mem + src, end - src);
+            memcpy(mem + h.v[k] + k * d, with, nwith);
+            end = h.v[k];
+        }
+    }
+
+    for(int m = 0; m < 26; ++m) {
+        markers[m] = remap_offset(markers[m], &h, nneedle, nwith);
+    }
+    if(memoffset >= first) memoffset = remap_offset(memoffset, &h, nneedle, nwith);
+    memsize = newsize;
+    if(memoffset >= memsize) memoffset = memsize ? memsize - 1 : 0;
+    lownibble = 0;
+
+    dirty_free(dirty);
+    dirty = newdirty;
+    mem_changed(first, SIZE_MAX);
+    for(size_t k = 0; k < h.n && nwith; ++k) {
+        size_t at = h.v[k] - k * nneedle + k * nwith;
+        mem_changed(at, at + nwith);
+    }
+
+done:
+    adjust_screen();
+    repaint();
+    update_details();
+    update_status();
+    mvhline(LINES - 1, 0, ' ', COLS);
+    mvprintw(LINES - 1, 0, "Replaced %zu occurrence%s", h.n, (h.n == 1) ? "" : "s");
+    goto end;
+
+invalid:
+    mvhline(LINES - 1, 0, ' ', COLS);
+    mvprintw(LINES - 1, 0, "Invalid format");
+end:
+    free(h.v);
+    free(needle);
+    free(mask);
+    free(with);
+}
+
+/* marks bytes [dst, dst + n) of the modified byte map `to' where bytes
+   [src, src + n) are marked in `dirty' */
+void copy_dirty(void* to, size_t dst, size_t src, size_t n)
+{
+    size_t i = dirty_next(dirty, src);
+    while(i != SIZE_MAX && i < src + n) {
+        size_t j = dirty_next_clean(dirty, i);
+        if(j > src + n) j = src + n;
+        dirty_mark(to, dst + (i - src), dst + (j - src));
+        i = dirty_next(dirty, j);
+    }
+}
+
+/* asks for a value, bytes, or the clipboard, and an offset, and writes
+   that at the offset from every hit of the last search, in one pass.
+   u undoes it */
+void apply_to_hits(void)
+{
+    if(memsize == 0) return;
+    if(!nSearchString || !searchString) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Nothing to look for; search with / first");
+        return;
+    }
+    char what = read_key("Write at every hit: v)alue b)ytes c)lipboard? ", "vbc");
+    if(!what) return;
+
+    unsigned char value[8];
+    unsigned char* bytes = NULL;    // malloc'd, or value or the clipboard
+    size_t n = 0;
+    if(what == 'v') {
+        const int S = LINES - 9 - 1;
+        for(int i = S; i < LINES - 1; ++i) mvhline(i, 0, ' ', COLS);
+        mvprintw(S, 0, "What do you want to punch in?");
+        mvprintw(S + 1, 0, "1) u16le 2) u16be 3) u32le 4) u32be");
+        mvprintw(S + 2, 0, "5) u64le 6) u64be 7) f32le 8) f32be");
+        mvprintw(S + 3, 0, "q) f64le w) f64be");
+        char choice = read_key("choice: ", "12345678qw");
+        char* s = choice ? read_string("enter scanf-friendly number: ") : NULL;
+        for(int i = S; i < LINES - 1; ++i) mvhline(i, 0, ' ', COLS);
+        paintedLines = 0;
+        repaint();
+        draw_separator();
+        update_details();
+        update_status();
+        if(!s) return;
+        n = encode_value(choice, s, value);
+        free(s);
+        bytes = value;
+    } else if(what == 'b') {
+        char* s = read_string("Bytes (as for /): ");
+        update_status();
+        if(!s) return;
+        unsigned char* mask = NULL;
+        int ok = parse_search_string(s, &bytes, &n, &mask);
+        free(s);
+        free(mask);
+        if(!ok || mask) {
+            free(bytes);
+            mvhline(LINES - 1, 0, ' ', COLS);
+            mvprintw(LINES - 1, 0, "Invalid format");
+            return;
+        }
+    } else {
+        if(!clipboard || !clipboardsize) {
+            mvhline(LINES - 1, 0, ' ', COLS);
+            mvprintw(LINES - 1, 0, "The clipboard is empty");
+            return;
+        }
+        bytes = clipboard;
+        n = clipboardsize;
+    }
+
+    struct hits h = { NULL, 0, 0 };
+    char* s = read_string("Offset from the start of every hit (e.g. 0, 4, -2): ");
+    update_status();
+    long rel = 0;
+    if(!s || sscanf(s, "%li", &rel) != 1) {
+        free(s);
+        goto end;
+    }
+    free(s);
+
+    if(!find_all(searchString, nSearchString, searchStringMask, 0, memsize - 1, &h)) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Cancelled; nothing was written");
+        goto end;
+    }
+
+    // keep the ones where it fits
+    size_t k = 0;
+    for(size_t i = 0; i < h.n; ++i) {
+        if(rel < 0 && h.v[i] < (size_t)-rel) continue;
+        size_t at = h.v[i] + (size_t)rel;
+        if(at > memsize || n > memsize - at) continue;
+        h.v[k++] = at;
+    }
+    size_t skipped = h.n - k;
+    h.n = k;
+    if(h.n == 0) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, skipped ? "None of the %zu hits has room for it" : "Not found", skipped);
+        goto end;
+    }
+
+    // what's there now goes in the journal, then it gets overwritten
+    unsigned char* old = malloc(h.n * n);
+    if(!old) abort();
+    for(size_t i = 0; i < h.n; ++i) memcpy(old + i * n, mem + h.v[i], n);
+    for(size_t i = 0; i < h.n; ++i) {
+        memcpy(mem + h.v[i], bytes, n);
+        mem_changed(h.v[i], h.v[i] + n);
+    }
+    free(journal.offsets);
+    free(journal.old);
+    journal.offsets = h.v;
+    journal.n = h.n;
+    journal.width = n;
+    journal.old = old;
+    journal.start = h.v[0];
+    journal.end = h.v[h.n - 1] + n;
+    h.v = NULL;
+
+    repaint();
+    update_details();
+    update_status();
+    mvhline(LINES - 1, 0, ' ', COLS);
+    if(skipped) {
+        mvprintw(LINES - 1, 0, "Wrote %zu bytes at %zu hits, %zu had no room; u undoes it",
+                n, journal.n, skipped);
+    } else {
+        mvprintw(LINES - 1, 0, "Wrote %zu bytes at %zu hits; u undoes it", n, journal.n);
+    }
+
+end:
+    free(h.v);
+    if(what == 'b') free(bytes);
+}
+
+/* puts back what the last & overwrote */
+void undo_apply(void)
+{
+    if(!journal.offsets) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Nothing to undo");
+        return;
+    }
+    // take it out of the journal first, or our own writes would drop it
+    size_t* offsets = journal.offsets;
+    unsigned char* old = journal.old;
+    size_t n = journal.n;
+    size_t width = journal.width;
+    journal.offsets = NULL;
+    journal.old = NULL;
+
+    // backwards, in case the writes overlapped
+    for(size_t i = n; i-- > 0; ) {
+        memcpy(mem + offsets[i], old + i * width, width);
+        mem_changed(offsets[i], offsets[i] + width);
+    }
+    free(offsets);
+    free(old);
+
+    repaint();
+    update_details();
+    update_status();
+    mvhline(LINES - 1, 0, ' ', COLS);
+    mvprintw(LINES - 1, 0, "Put back the bytes at %zu hits", n);
+}
+
 /* save an address in one of the 26 registers */
 void set_marker(void)
 {
@@ -1846,7 +3896,7 @@ void list_markers(void)
     for(int i = 0; i < 26; ++i) {
         if(n >= LINES - 1) {
             mvprintw(LINES - 1, 0, "Press any key to continue....");
-            getch();
+            getkey();
             n = 0;
         }
         mvprintw(n, 0, "%c: %016lx %ld", i + 'a', markers[i], markers[i]);
@@ -1854,29 +3904,648 @@ void list_markers(void)
     }
 
     mvprintw(LINES - 1, 0, "Press any key to continue....");
-    getch();
+    getkey();
+    redraw();
+}
+
+/* show a full screen list of n rows, where row i is printed by
+   fmt(i, buf, sizeof(buf), ctx), and let the user pick one. The
+   selection starts at *psel. Returns '\n' if a row was picked with ENTER,
+   or the key if it's one of `keys', with the selected row in *psel.
+   Returns 0 if the user went back with q, ESC, ^C or ^G.
+   Only the rows on screen get formatted, so n can be huge. */
+int browse_list(const char* title, size_t n,
+        void (*fmt)(size_t, char*, size_t, void*), void* ctx,
+        const char* keys, size_t* psel)
+{
+    size_t sel = (*psel < n) ? *psel : n - (n > 0);
+    size_t top = 0;
+    char buf[256];
+    for(;;) {
+        size_t rows = (LINES > 3) ? LINES - 2 : 1;
+        if(sel < top) top = sel;
+        if(sel >= top + rows) top = sel - rows + 1;
+
+        erase();
+        attron(A_STANDOUT);
+        mvhline(0, 0, ' ', COLS);
+        mvaddnstr(0, 0, title, COLS);
+        attroff(A_STANDOUT);
+        for(size_t i = 0; i < rows && top + i < n; ++i) {
+            fmt(top + i, buf, sizeof(buf), ctx);
+            if(top + i == sel) {
+                attron(A_REVERSE);
+                mvhline(1 + i, 0, ' ', COLS);
+            }
+            mvaddnstr(1 + i, 0, buf, COLS);
+            attroff(A_REVERSE);
+        }
+        mvprintw(LINES - 1, 0, "%zu/%zu  ENTER to pick, q to go back", sel + (n > 0), n);
+
+        int c = getkey();
+        switch(c) {
+            case 'j':
+            case KEY_DOWN:
+                if(sel + 1 < n) ++sel;
+                break;
+            case 'k':
+            case KEY_UP:
+                if(sel > 0) --sel;
+                break;
+            case 6: // ^F
+            case KEY_NPAGE:
+                sel = (sel + rows < n) ? sel + rows : n - (n > 0);
+                break;
+            case 2: // ^B
+            case KEY_PPAGE:
+                sel = (sel > rows) ? sel - rows : 0;
+                break;
+            case KEY_HOME:
+                sel = 0;
+                break;
+            case KEY_END:
+                sel = n - (n > 0);
+                break;
+            case 10:
+            case 13:
+            case KEY_ENTER:
+                if(n == 0) break;
+                *psel = sel;
+                return '\n';
+            case 'q':
+            case 3: // ^C
+            case 7: // ^G
+            case 27: // ESC
+                return 0;
+            default:
+                if(c > 0 && c < 256 && keys && strchr(keys, c)) {
+                    *psel = sel;
+                    return c;
+                }
+                break;
+        }
+    }
+}
+
+/* one overview row; ctx points to the level */
+static void overview_row(size_t i, char* buf, size_t nbuf, void* ctx)
+{
+    int level = *(int*)ctx;
+    size_t bs = summary_block_size(level);
+    double entropy, zeros, printable;
+    summary_get(summary, level, i, &entropy, &zeros, &printable);
+
+    char bar[21];
+    int w = (int)(entropy / 8.0 * 20.0 + 0.5);
+    if(w > 20) w = 20;
+    memset(bar, '#', w);
+    memset(bar + w, '.', 20 - w);
+    bar[20] = '\0';
+
+    snprintf(buf, nbuf, "%c %016zx  %s  entropy %4.2f  zeros %3d%%  text %3d%%",
+            (memoffset / bs == i) ? '>' : ' ',
+            i * bs, bar, entropy,
+            (int)(zeros * 100.0 + 0.5), (int)(printable * 100.0 + 0.5));
+}
+
+/* bird's eye view of the buffer: entropy, fraction of zeros and fraction
+   of printable bytes for every 4KiB, 256KiB or 16MiB block. + and - zoom
+   in and out, ENTER jumps to the selected block. */
+void overview(void)
+{
+    if(memsize == 0) return;
+
+    if(!summary) {
+        summary = summary_build(mem, memsize);
+    } else if(summaryStaleFrom < summaryStaleTo) {
+        if(!summary_update(summary, mem, memsize, summaryStaleFrom, summaryStaleTo)) {
+            summary_free(summary);
+            summary = NULL;
+        }
+    }
+    summaryStaleFrom = SIZE_MAX;
+    summaryStaleTo = 0;
+    if(!summary) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Not enough memory for the overview");
+        return;
+    }
+
+    // start at the finest level which fits on one screen
+    int level = 0;
+    while(level + 1 < summary_levels()
+            && summary_blocks(summary, level) > (size_t)(LINES - 2))
+        ++level;
+    size_t addr = memoffset;
+    for(;;) {
+        size_t bs = summary_block_size(level);
+        size_t sel = addr / bs;
+        char title[128];
+        snprintf(title, sizeof(title),
+                "Overview, %zu%s per row; + and - zoom in and out",
+                (bs >= 1024 * 1024) ? bs >> 20 : bs >> 10,
+                (bs >= 1024 * 1024) ? "MiB" : "KiB");
+        int c = browse_list(title, summary_blocks(summary, level),
+                overview_row, &level, "+-", &sel);
+        // keep the selection where it was when zooming out and back in
+        if(sel != addr / bs) addr = sel * bs;
+        if(c == '+') {
+            if(level > 0) --level;
+        } else if(c == '-') {
+            if(level + 1 < summary_levels()) ++level;
+        } else {
+            if(c == '\n') {
+                memoffset = addr;
+                lownibble = 0;
+                adjust_window();
+            }
+            break;
+        }
+    }
+    redraw();
+}
+
+/* one row of the strings list; ctx is what strings_find() returned */
+static void string_row(size_t i, char* buf, size_t nbuf, void* ctx)
+{
+    size_t offset, length;
+    int wide;
+    strings_get(ctx, i, &offset, &length, &wide);
+
+    int n = snprintf(buf, nbuf, "%016zx %-5s ", offset, wide ? "utf16" : "ascii");
+    if(n < 0) return;
+    size_t k = (size_t)n;
+    for(size_t j = 0; j < length && k + 1 < nbuf; j += 1 + wide) {
+        unsigned char c = mem[offset + j];
+        buf[k++] = (c == '\t') ? ' ' : c;
+    }
+    buf[k] = '\0';
+}
+
+/* prompts for a minimum length and lists the strings in the buffer;
+   ENTER jumps to the selected one */
+void list_strings(void)
+{
+    if(memsize == 0) return;
+    char* s = read_string("Minimum string length: ");
+    update_status();
+    if(!s) return;
+    long minlen = 0;
+    sscanf(s, "%li", &minlen);
+    free(s);
+    if(minlen < 1) minlen = 4;
+
+    struct probe p = probe_begin(STAT_SEARCH);
+    void* list = strings_find(mem, memsize, (size_t)minlen);
+    p.bytes = memsize;
+    probe_end(p);
+    if(!list) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Not enough memory for that many strings");
+        return;
+    }
+    size_t n = strings_count(list);
+    if(n == 0) {
+        strings_free(list);
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "No strings of %ld or more characters", minlen);
+        return;
+    }
+
+    // start at the first string which isn't behind the cursor
+    size_t lo = 0, hi = n - 1;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        size_t offset, length;
+        int wide;
+        strings_get(list, mid, &offset, &length, &wide);
+        if(offset + length <= memoffset) lo = mid + 1;
+        else hi = mid;
+    }
+    size_t sel = lo;
+
+    char title[128];
+    snprintf(title, sizeof(title), "%zu strings of %ld or more characters", n, minlen);
+    if(browse_list(title, n, string_row, list, NULL, &sel) == '\n') {
+        size_t offset, length;
+        int wide;
+        strings_get(list, sel, &offset, &length, &wide);
+        memoffset = offset;
+        lownibble = 0;
+        adjust_window();
+    }
+    strings_free(list);
+    redraw();
+}
+
+/* loads more signatures for carve_files() from a file with lines like
+       name offset pattern
+   where pattern uses the find syntax, minus bit patterns. Empty lines and
+   lines starting with # are skipped. This happens before curses starts,
+   so errors go to stderr and we quit */
+void load_magic(const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if(!f) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        exit(2);
+    }
+    char line[4096];
+    int lineno = 0;
+    while(fgets(line, sizeof(line), f)) {
+        ++lineno;
+        line[strcspn(line, "\r\n")] = '\0';
+        char* p = line;
+        while(*p == ' ' || *p == '\t') ++p;
+        if(*p == '\0' || *p == '#') continue;
+
+        char name[64];
+        long offset = -1;
+        int used = 0;
+        unsigned char* needle = NULL;
+        unsigned char* mask = NULL;
+        size_t nneedle = 0;
+        int ok = sscanf(p, "%63s %li %n", name, &offset, &used) == 2
+            && offset >= 0
+            && parse_search_string(p + used, &needle, &nneedle, &mask)
+            && !mask
+            && carve_add(name, (size_t)offset, needle, nneedle);
+        free(needle);
+        free(mask);
+        if(!ok) {
+            fprintf(stderr, "%s:%d: expected `name offset pattern', with a pattern of at least 2 bytes\n",
+                    path, lineno);
+            exit(2);
+        }
+    }
+    fclose(f);
+}
+
+// where embedded file i ends; if its length isn't known, that's where the
+// next one starts
+static size_t carved_end(void* hits, size_t i)
+{
+    size_t start, length;
+    const char* info;
+    carve_get(hits, i, &start, &length, &info);
+    if(length) return (length < memsize - start) ? start + length : memsize;
+    for(size_t j = i + 1; j < carve_count(hits); ++j) {
+        size_t next;
+        carve_get(hits, j, &next, &length, &info);
+        if(next > start) return next;
+    }
+    return memsize;
+}
+
+/* one row of the embedded files list; ctx is what carve_scan() returned */
+static void carve_row(size_t i, char* buf, size_t nbuf, void* ctx)
+{
+    size_t start, length;
+    const char* info;
+    carve_get(ctx, i, &start, &length, &info);
+    char len[32];
+    if(length == 0) snprintf(len, sizeof(len), "?");
+    else snprintf(len, sizeof(len), "%zu%s", length,
+            (length > memsize - start) ? "!" : "");
+    snprintf(buf, nbuf, "%016zx %12s  %s", start, len, info);
+}
+
+/* lists what looks like files embedded in the buffer, e.g. gzip streams
+   or ELF binaries in a firmware image. ENTER jumps to one, m sets a pair
+   of markers around it and w writes it out to a file */
+void carve_files(void)
+{
+    if(memsize == 0) return;
+    struct probe p = probe_begin(STAT_SEARCH);
+    void* hits = carve_scan(mem, memsize);
+    p.bytes = memsize;
+    probe_end(p);
+    if(!hits) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Not enough memory for that many embedded files");
+        return;
+    }
+    size_t n = carve_count(hits);
+    if(n == 0) {
+        carve_free(hits);
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Nothing looks like an embedded file");
+        return;
+    }
+
+    // start at the first one which isn't behind the cursor
+    size_t sel = 0, start, length, end = 0;
+    const char* info;
+    for(; sel + 1 < n; ++sel) {
+        carve_get(hits, sel, &start, &length, &info);
+        if(start >= memoffset) break;
+    }
+
+    char title[128];
+    snprintf(title, sizeof(title),
+            "%zu embedded files (?: length unknown, !: cut short); m marks, w writes", n);
+    int c = browse_list(title, n, carve_row, hits, "mw", &sel);
+    if(c) {
+        carve_get(hits, sel, &start, &length, &info);
+        end = carved_end(hits, sel);
+    }
+    carve_free(hits);
+
+    if(c == '\n') {
+        memoffset = start;
+        lownibble = 0;
+        adjust_window();
+    }
     redraw();
+    if(c == 'm') {
+        char c1 = read_key("Marker for the start: ", "abcdefghijklmnopqrstuvwxyz");
+        if(!c1) return;
+        char c2 = read_key("Marker for the end: ", "abcdefghijklmnopqrstuvwxyz");
+        if(!c2) return;
+        markers[c1 - 'a'] = start;
+        markers[c2 - 'a'] = end - 1;
+        update_status();
+    } else if(c == 'w') {
+        write_range(start, end - 1);
+    }
+}
+
+/* jump to the address stored in a marker */
+void goto_marker(void)
+{
+    if(memsize == 0) return;
+
+    char c = read_key("Which marker? ", "abcdefghijklmnopqrstuvwxyz");
+
+    if(c == 0) return;
+
+    int i = c - 'a';
+
+    size_t addr = markers[i];
+
+    if(addr < memsize) {
+        memoffset = addr;
+        adjust_screen();
+        update_details();
+        update_status();
+    }
+}
+
+/* queue up edits, list them, and apply or drop them */
+void transaction(void)
+{
+    char prompt[128];
+    snprintf(prompt, sizeof(prompt),
+            "%zu edit%s queued; i)nsert d)elete o)verwrite l)ist c)ommit a)bort: ",
+            txCount, (txCount == 1) ? "" : "s");
+    char c = read_key(prompt, "idolca");
+    switch(c) {
+        case 'i': tx_queue(TX_INSERT); break;
+        case 'd': tx_queue(TX_DELETE); break;
+        case 'o': tx_queue(TX_OVERWRITE); break;
+        case 'l': tx_list(); break;
+        case 'c': tx_commit(); break;
+        case 'a':
+            tx_clear();
+            mvhline(LINES - 1, 0, ' ', COLS);
+            mvprintw(LINES - 1, 0, "Dropped the queued edits");
+            break;
+    }
+}
+
+/* asks for an address and the bytes to insert or overwrite there, or how
+   many bytes to delete, and queues that */
+void tx_queue(int kind)
+{
+    char* s = read_string((kind == TX_INSERT)
+            ? "Insert before (address, or . for the cursor): "
+            : (kind == TX_DELETE)
+            ? "Delete from (address, or . for the cursor): "
+            : "Overwrite from (address, or . for the cursor): ");
+    update_status();
+    if(!s) return;
+    size_t offset = memoffset;
+    ssize_t addr = -1;
+    int ok = (strcmp(s, ".") == 0) || (sscanf(s, "%zi", &addr) == 1 && addr >= 0);
+    if(addr >= 0) offset = (size_t)addr;
+    free(s);
+    if(!ok) goto invalid;
+
+    unsigned char* data = NULL;
+    size_t length = 0;
+    if(kind == TX_DELETE) {
+        s = read_string("How many bytes: ");
+        update_status();
+        if(!s) return;
+        long n = 0;
+        ok = sscanf(s, "%li", &n) == 1 && n > 0;
+        free(s);
+        if(!ok) goto invalid;
+        length = (size_t)n;
+    } else {
+        s = read_string("Bytes (as for /): ");
+        update_status();
+        if(!s) return;
+        unsigned char* mask = NULL;
+        ok = parse_search_string(s, &data, &length, &mask);
+        free(s);
+        free(mask);
+        if(!ok || mask) {
+            free(data);
+            goto invalid;
+        }
+    }
+
+    if(txCount >= txCapacity) {
+        txCapacity = txCapacity ? txCapacity * 2 : 16;
+        txOps = realloc(txOps, txCapacity * sizeof(struct txop));
+        if(!txOps) abort();
+    }
+    struct txop* op = &txOps[txCount++];
+    op->kind = kind;
+    op->offset = offset;
+    op->length = length;
+    op->data = data;
+    op->seq = txSeq++;
+    mvhline(LINES - 1, 0, ' ', COLS);
+    mvprintw(LINES - 1, 0, "%zu edit%s queued; | c applies them",
+            txCount, (txCount == 1) ? "" : "s");
+    return;
+
+invalid:
+    mvhline(LINES - 1, 0, ' ', COLS);
+    mvprintw(LINES - 1, 0, "Invalid format");
+}
+
+static void txop_row(size_t i, char* buf, size_t nbuf, void* ctx)
+{
+    (void)ctx;
+    struct txop* op = &txOps[i];
+    int n = snprintf(buf, nbuf, "%-9s %016zx  %zu byte%s%s",
+            (op->kind == TX_INSERT) ? "insert" : (op->kind == TX_DELETE) ? "delete" : "overwrite",
+            op->offset, op->length, (op->length == 1) ? "" : "s",
+            op->data ? ":" : "");
+    for(size_t k = 0; op->data && k < op->length && n + 4 < (int)nbuf; ++k) {
+        n += snprintf(buf + n, nbuf - n, " %02x", op->data[k]);
+    }
+}
+
+/* lists the queued edits; x drops one */
+void tx_list(void)
+{
+    size_t sel = 0;
+    while(txCount) {
+        char title[64];
+        snprintf(title, sizeof(title), "%zu queued edits; x drops one", txCount);
+        if(browse_list(title, txCount, txop_row, NULL, "x", &sel) != 'x') break;
+        free(txOps[sel].data);
+        memmove(txOps + sel, txOps + sel + 1, (txCount - sel - 1) * sizeof(struct txop));
+        txCount--;
+    }
+    redraw();
+    if(!txCount) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "No edits queued");
+    }
+}
+
+/* forgets the queued edits */
+void tx_clear(void)
+{
+    for(size_t i = 0; i < txCount; ++i) free(txOps[i].data);
+    txCount = 0;
 }
 
-/* jump to the address stored in a marker */
-void goto_marker(void)
+static int txop_cmp(const void* va, const void* vb)
 {
-    if(memsize == 0) return;
+    const struct txop* a = va;
+    const struct txop* b = vb;
+    if(a->offset != b->offset) return (a->offset < b->offset) ? -1 : 1;
+    // inserts go before whatever else happens at the same address
+    if((a->kind == TX_INSERT) != (b->kind == TX_INSERT)) return (a->kind == TX_INSERT) ? -1 : 1;
+    return (a->seq < b->seq) ? -1 : (a->seq > b->seq);
+}
 
-    char c = read_key("Which marker? ", "abcdefghijklmnopqrstuvwxyz");
+// a stretch of the buffer after the commit, either bytes which were in it
+// before or bytes from an edit
+struct piece {
+    size_t src;                 // SIZE_MAX for inserted bytes
+    size_t dst;
+    size_t length;
+    const unsigned char* data;  // NULL if the bytes are moved from src
+};
 
-    if(c == 0) return;
+// where byte x of the buffer goes; deleted bytes go where their deletion is
+static size_t tx_remap(size_t x, const struct piece* p, size_t n, size_t newsize)
+{
+    if(x >= memsize) return newsize + (x - memsize);
+    for(size_t i = 0; i < n; ++i) {
+        if(p[i].src == SIZE_MAX) continue;
+        if(x < p[i].src) return p[i].dst;
+        if(x < p[i].src + p[i].length) return p[i].dst + (x - p[i].src);
+    }
+    return newsize;
+}
 
-    int i = c - 'a';
+/* applies the queued edits in one sweep: every byte of the buffer moves at
+   most once, however many edits there are */
+void tx_commit(void)
+{
+    if(txCount == 0) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "No edits queued");
+        return;
+    }
+    qsort(txOps, txCount, sizeof(struct txop), txop_cmp);
+
+    // lay out the new buffer
+    struct piece* p = malloc((2 * txCount + 1) * sizeof(struct piece));
+    if(!p) abort();
+    size_t np = 0, pos = 0, dst = 0;
+    int resized = 0;
+    for(size_t i = 0; i < txCount; ++i) {
+        struct txop* op = &txOps[i];
+        if(op->offset > memsize
+                || (op->kind != TX_INSERT && op->length > memsize - op->offset)) {
+            mvhline(LINES - 1, 0, ' ', COLS);
+            mvprintw(LINES - 1, 0, "The edit at %zx goes past the end; nothing was done", op->offset);
+            free(p);
+            return;
+        }
+        if(op->offset < pos) {
+            mvhline(LINES - 1, 0, ' ', COLS);
+            mvprintw(LINES - 1, 0, "The edit at %zx overlaps the one before it; nothing was done", op->offset);
+            free(p);
+            return;
+        }
+        if(op->offset > pos) {
+            p[np++] = (struct piece){ pos, dst, op->offset - pos, NULL };
+            dst += op->offset - pos;
+            pos = op->offset;
+        }
+        if(op->kind != TX_DELETE) {
+            size_t src = (op->kind == TX_OVERWRITE) ? pos : SIZE_MAX;
+            p[np++] = (struct piece){ src, dst, op->length, op->data };
+            dst += op->length;
+        }
+        if(op->kind != TX_INSERT) pos += op->length;
+        if(op->kind != TX_OVERWRITE) resized = 1;
+    }
+    if(pos < memsize) {
+        p[np++] = (struct piece){ pos, dst, memsize - pos, NULL };
+        dst += memsize - pos;
+    }
+    size_t newsize = dst;
+    size_t first = txOps[0].offset;
 
-    size_t addr = markers[i];
+    if(memcapacity < newsize) {
+        grow_vector(&mem, newsize);
+        if(!mem) abort();
+        memcapacity = newsize;
+    }
+    // bytes moving down go front to back and bytes moving up back to
+    // front, so nothing gets overwritten before it's moved
+    for(size_t i = 0; i < np; ++i) {
+        if(!p[i].data && p[i].dst < p[i].src) memmove(mem + p[i].dst, mem + p[i].src, p[i].length);
+    }
+    for(size_t i = np; i-- > 0; ) {
+        if(!p[i].data && p[i].dst > p[i].src) memmove(mem + p[i].dst, mem + p[i].src, p[i].length);
+    }
+    for(size_t i = 0; i < np; ++i) {
+        if(p[i].data) memcpy(mem + p[i].dst, p[i].data, p[i].length);
+    }
 
-    if(addr < memsize) {
-        memoffset = addr;
-        adjust_screen();
-        update_details();
-        update_status();
+    void* newdirty = NULL;
+    if(dirty && resized && (newdirty = dirty_new(newsize))) {
+        for(size_t i = 0; i < np; ++i) {
+            if(!p[i].data) copy_dirty(newdirty, p[i].dst, p[i].src, p[i].length);
+        }
+    }
+    for(int m = 0; m < 26; ++m) markers[m] = tx_remap(markers[m], p, np, newsize);
+    memoffset = tx_remap(memoffset, p, np, newsize);
+    memsize = newsize;
+    if(memoffset >= memsize) memoffset = memsize ? memsize - 1 : 0;
+    lownibble = 0;
+
+    if(resized) {
+        dirty_free(dirty);
+        dirty = newdirty;
+        mem_changed(first, SIZE_MAX);
+    }
+    for(size_t i = 0; i < np; ++i) {
+        if(p[i].data) mem_changed(p[i].dst, p[i].dst + p[i].length);
     }
+    free(p);
+
+    size_t n = txCount;
+    tx_clear();
+    adjust_screen();
+    repaint();
+    update_details();
+    update_status();
+    mvhline(LINES - 1, 0, ' ', COLS);
+    mvprintw(LINES - 1, 0, "Applied %zu edit%s; the buffer is %zu bytes now",
+            n, (n == 1) ? "" : "s", memsize);
 }
 
 /* ask the user for a pair of markers. Returns the first and second
@@ -1916,8 +4585,11 @@ void blank_region(void)
     if(!read_pair_of_markers(&a1, &a2)) return;
 
     memset(mem + a1, 0, a2 - a1 + 1);
+    mem_changed(a1, a2 + 1);
 
-    redraw();
+    repaint();
+    update_details();
+    update_status();
 }
 
 /* ask the user for a pair of markers, and removes those bytes. The buffer
@@ -1930,12 +4602,16 @@ void kill_region(void)
 
     memmove(mem + a1, mem + a2 + 1, memsize - a2 - 1);
     memsize -= a2 - a1 + 1;
+    if(dirty) dirty_delete(dirty, a1, a2 - a1 + 1);
+    mem_changed(a1, SIZE_MAX);
 
     memoffset = a1;
     if(memoffset > 0) --memoffset;
 
     adjust_screen();
-    redraw();
+    repaint();
+    update_details();
+    update_status();
 }
 
 /* ask the user for a pair of markers and copies that to a hidden buffer */
@@ -1960,7 +4636,138 @@ void write_region(void)
     if(memsize == 0) return;
     size_t a1, a2;
     if(!read_pair_of_markers(&a1, &a2)) return;
+    write_range(a1, a2);
+}
+
+/* asks for a hash and a pair of markers, or the whole buffer, and shows
+   the hash of those bytes */
+void hash_region(void)
+{
+    if(memsize == 0) return;
+    char c = read_key("Hash c)rc32 C)rc32c x)xxh64 s)ha256: ", "cCxs");
+    if(!c) return;
+    char over = read_key("Over the w)hole buffer or between m)arkers? ", "wm");
+    if(!over) return;
+
+    size_t a1 = 0, a2 = memsize - 1;
+    if(over == 'm') {
+        if(!read_pair_of_markers(&a1, &a2)) return;
+        if(a2 >= memsize) a2 = memsize - 1;
+        if(a1 > a2) a1 = a2;
+    }
+    const unsigned char* p = mem + a1;
+    size_t n = a2 - a1 + 1;
+
+    char digest[65];
+    const char* name = "";
+    mvhline(LINES - 1, 0, ' ', COLS);
+    mvprintw(LINES - 1, 0, "Hashing %zu bytes...", n);
+    refresh();
+    switch(c) {
+        case 'c':
+            name = "crc32";
+            snprintf(digest, sizeof(digest), "%08x", (unsigned)hash_crc32(p, n));
+            break;
+        case 'C':
+            name = "crc32c";
+            snprintf(digest, sizeof(digest), "%08x", (unsigned)hash_crc32c(p, n));
+            break;
+        case 'x':
+            name = "xxh64";
+            snprintf(digest, sizeof(digest), "%016llx",
+                    (unsigned long long)hash_xxh64(p, n));
+            break;
+        case 's': {
+            unsigned char sha[32];
+            name = "sha256";
+            hash_sha256(p, n, sha);
+            for(int i = 0; i < 32; ++i) {
+                digest[2 * i] = HEX[sha[i] >> 4];
+                digest[2 * i + 1] = HEX[sha[i] & 0xF];
+            }
+            digest[64] = '\0';
+            break;
+        }
+    }
+
+    // a sha256 of a big range doesn't fit with the range
+    char line[128];
+    snprintf(line, sizeof(line), "%s of %zx-%zx: %s", name, a1, a2, digest);
+    if((int)strlen(line) > COLS) snprintf(line, sizeof(line), "%s %s", name, digest);
+    mvhline(LINES - 1, 0, ' ', COLS);
+    mvprintw(LINES - 1, 0, "%s", line);
+}
+
+// regions get transformed this much at a time, between progress updates
+#define TRANSFORM_BATCH (64ul << 20)
+
+/* asks for a transform, its key if it needs one, and a pair of markers,
+   and transforms the bytes in between */
+void transform_region(void)
+{
+    if(memsize == 0) return;
+    char op = read_key("Transform x)or +)add -)subtract f)ill s)wap bytes r)everse bits: ", "x+-fsr");
+    if(!op) return;
+
+    unsigned char* key = NULL;
+    size_t nkey = 0;
+    if(op == 's') {
+        op = read_key("Swap the bytes of 2, 4 or 8 byte words? ", "248");
+        if(!op) return;
+    } else if(op != 'r') {
+        char* s = read_string("Key (as for /): ");
+        update_status();
+        if(!s) return;
+        unsigned char* mask = NULL;
+        int ok = parse_search_string(s, &key, &nkey, &mask);
+        free(s);
+        free(mask);
+        if(!ok || mask) {
+            free(key);
+            mvhline(LINES - 1, 0, ' ', COLS);
+            mvprintw(LINES - 1, 0, "Invalid format");
+            return;
+        }
+    }
+
+    size_t a1, a2;
+    if(!read_pair_of_markers(&a1, &a2)) goto end;
+    if(a2 >= memsize) a2 = memsize - 1;
+    if(a1 > a2) a1 = a2;
+    size_t n = a2 - a1 + 1;
+
+    // a batch at a time, so we can show progress and stop
+    size_t done = 0;
+    int ok = 1;
+    while(done < n) {
+        size_t len = (n - done < TRANSFORM_BATCH) ? n - done : TRANSFORM_BATCH;
+        if(!(ok = transform(mem + a1 + done, len, done, op, key, nkey))) break;
+        done += len;
+        if(done < n && !progress("Transforming", done, n)) break;
+    }
+    if(done) mem_changed(a1, a1 + done);
+    repaint();
+    update_details();
+    update_status();
+
+    mvhline(LINES - 1, 0, ' ', COLS);
+    if(!ok) {
+        mvprintw(LINES - 1, 0, "Not enough memory; transformed %zu of %zu bytes", done, n);
+    } else if(done < n) {
+        mvprintw(LINES - 1, 0, "Cancelled; transformed %zu of %zu bytes", done, n);
+    } else if(op >= '2' && op <= '8' && n % (size_t)(op - '0')) {
+        mvprintw(LINES - 1, 0, "Transformed %zu bytes; the last %zu aren't a whole word and were left alone",
+                n, n % (size_t)(op - '0'));
+    } else {
+        mvprintw(LINES - 1, 0, "Transformed %zu bytes", n);
+    }
+end:
+    free(key);
+}
 
+/* prompts for a file name and writes bytes [a1, a2] to it */
+void write_range(size_t a1, size_t a2)
+{
     char* buf = read_filename();
     update_status();
     if(!buf) return;
@@ -1975,7 +4782,10 @@ void write_region(void)
         return;
     }
 
+    struct probe p = probe_begin(STAT_WRITE);
     size_t written = fwrite(mem + a1, 1, a2 - a1 + 1, f);
+    p.bytes = written;
+    probe_end(p);
     if(written == a2 - a1 + 1) {
         mvhline(LINES - 1, 0, ' ', COLS);
         mvprintw(LINES - 1, 0, "Wrote %zd bytes", written);
@@ -1989,6 +4799,14 @@ void write_region(void)
         }
     }
     fclose(f);
+
+    // if that was the file we loaded, we don't know what's in it anymore
+    struct stat sb;
+    if(merkleDisk && stat(fname, &sb) == 0
+            && sb.st_dev == diskStat.st_dev && sb.st_ino == diskStat.st_ino) {
+        merkle_free(merkleDisk);
+        merkleDisk = NULL;
+    }
 }
 
 /* insert the contents of the hidden buffer at the specified location */
@@ -2000,7 +4818,9 @@ void paste_clipboard(size_t before)
 
     memcpy(mem + before, clipboard, clipboardsize);
 
-    redraw();
+    repaint();
+    update_details();
+    update_status();
 
     mvhline(LINES - 1, 0, ' ', COLS);
     mvprintw(LINES - 1, 0, "Inserted %zd bytes", clipboardsize);
@@ -2016,9 +4836,549 @@ void overwrite_clipboard(void)
     }
 
     memcpy(mem + memoffset, clipboard, clipboardsize);
+    mem_changed(memoffset, memoffset + clipboardsize);
 
-    redraw();
+    repaint();
+    update_details();
+    update_status();
 
     mvhline(LINES - 1, 0, ' ', COLS);
     mvprintw(LINES - 1, 0, "Punched over %zd bytes", clipboardsize);
 }
+
+/* parses a field list such as `0:u32le 4:f32be 8:s8' for records of size
+   bytes. A field without an offset comes right after the one before it.
+   Returns 0, saying why on the status line, if it's no good */
+int parse_fields(const char* s, size_t size, struct field** pf, size_t* pn)
+{
+    struct field* v = NULL;
+    size_t n = 0;
+    size_t next = 0;
+    char tok[64];
+    const char* p = s;
+    for(;;) {
+        while(*p == ' ' || *p == ',') ++p;
+        if(!*p) break;
+        size_t k = 0;
+        while(*p && *p != ' ' && *p != ',') {
+            if(k + 1 < sizeof(tok)) tok[k++] = *p;
+            ++p;
+        }
+        tok[k] = '\0';
+
+        struct field f = { next, 0, 0, 0 };
+        char* t = tok;
+        char* colon = strchr(tok, ':');
+        if(colon) {
+            char* end;
+            f.offset = strtoul(tok, &end, 0);
+            if(end != colon) goto bad;
+            t = colon + 1;
+        }
+        f.type = *t;
+        if(!f.type || !strchr("usxf", f.type)) goto bad;
+        char* end;
+        long bits = strtol(t + 1, &end, 10);
+        if(bits != 8 && bits != 16 && bits != 32 && bits != 64) goto bad;
+        f.width = (int)(bits / 8);
+        if(f.type == 'f' && f.width < 4) goto bad;
+        if(strcmp(end, "be") == 0) f.be = 1;
+        else if(*end && strcmp(end, "le") != 0) goto bad;
+        if(f.offset >= size || (size_t)f.width > size - f.offset) {
+            free(v);
+            mvhline(LINES - 1, 0, ' ', COLS);
+            mvprintw(LINES - 1, 0, "%s doesn't fit in a %zu byte record", tok, size);
+            return 0;
+        }
+
+        struct field* nv = realloc(v, (n + 1) * sizeof(struct field));
+        if(!nv) {
+            free(v);
+            mvhline(LINES - 1, 0, ' ', COLS);
+            mvprintw(LINES - 1, 0, "Not enough memory");
+            return 0;
+        }
+        v = nv;
+        v[n++] = f;
+        next = f.offset + f.width;
+    }
+    if(n == 0) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "No fields");
+        return 0;
+    }
+    *pf = v;
+    *pn = n;
+    return 1;
+
+bad:
+    free(v);
+    mvhline(LINES - 1, 0, ' ', COLS);
+    mvprintw(LINES - 1, 0, "Bad field %s; fields look like 0:u32le 4:f32be 8:s8 12:x16", tok);
+    return 0;
+}
+
+/* prints a field the way it's typed in, e.g. 4:f32be */
+void field_label(const struct field* f, char* buf, size_t nbuf)
+{
+    snprintf(buf, nbuf, "%zu:%c%d%s", f->offset, f->type, 8 * f->width,
+            (f->width == 1) ? "" : f->be ? "be" : "le");
+}
+
+/* asks for the record size, offering the last one. Returns 0 if there's
+   none */
+size_t read_record_size(void)
+{
+    char prompt[64];
+    if(recordSize) snprintf(prompt, sizeof(prompt), "Record size [%zu]: ", recordSize);
+    else snprintf(prompt, sizeof(prompt), "Record size: ");
+    char* s = read_string(prompt);
+    update_status();
+    size_t size = recordSize;
+    if(s) {
+        size = 0;
+        sscanf(s, "%zi", &size);
+        free(s);
+    }
+    return size;
+}
+
+/* asks for one field of records of size bytes, to sort or search by,
+   offering the last one, or the first field of the layout */
+int read_field(const char* what, size_t size, struct field* pf)
+{
+    char last[32] = "";
+    if(keySpec) snprintf(last, sizeof(last), "%s", keySpec);
+    else if(nfields) field_label(&fields[0], last, sizeof(last));
+    char prompt[128];
+    if(*last) snprintf(prompt, sizeof(prompt), "%s [%s]: ", what, last);
+    else snprintf(prompt, sizeof(prompt), "%s (e.g. 0:u32le): ", what);
+    char* s = read_string(prompt);
+    update_status();
+    if(!s) {
+        if(!*last) return 0;
+        s = strdup(last);
+        if(!s) return 0;
+    }
+    struct field* f;
+    size_t n;
+    if(!parse_fields(s, size, &f, &n)) {
+        free(s);
+        return 0;
+    }
+    if(n > 1) {
+        free(f);
+        free(s);
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Just the one field, please");
+        return 0;
+    }
+    *pf = f[0];
+    free(f);
+    free(keySpec);
+    keySpec = s;
+    return 1;
+}
+
+/* asks for the record size and the fields in a record, offering the last
+   ones. Returns 0 if there's no layout to go on */
+int read_layout(void)
+{
+    char prompt[128];
+    size_t size = read_record_size();
+    if(size == 0) return 0;
+
+    if(fieldSpec) snprintf(prompt, sizeof(prompt), "Fields [%.100s]: ", fieldSpec);
+    else snprintf(prompt, sizeof(prompt), "Fields (e.g. 0:u32le 4:f32be 8:s8): ");
+    char* s = read_string(prompt);
+    update_status();
+    if(!s) {
+        if(!fieldSpec) return 0;
+        s = strdup(fieldSpec);
+        if(!s) return 0;
+    }
+    struct field* f;
+    size_t n;
+    if(!parse_fields(s, size, &f, &n)) {
+        free(s);
+        return 0;
+    }
+    free(fields);
+    fields = f;
+    nfields = n;
+    recordSize = size;
+    free(fieldSpec);
+    fieldSpec = s;
+    return 1;
+}
+
+// what the record view is showing
+struct recview {
+    size_t base;        // where the first record starts
+    size_t n;           // how many records there are
+    int* columns;       // how wide every field's column is
+};
+
+/* how many characters a field can take up on screen */
+static int field_columns(const struct field* f)
+{
+    static const int u[] = { 3, 5, 0, 10, 0, 0, 0, 20 };
+    static const int s[] = { 4, 6, 0, 11, 0, 0, 0, 20 };
+    switch(f->type) {
+        case 'x': return 2 * f->width;
+        case 'f': return (f->width == 4) ? 14 : 22;
+        case 's': return s[f->width - 1];
+    }
+    return u[f->width - 1];
+}
+
+/* one record: its address, then every field */
+static void record_row(size_t i, char* buf, size_t nbuf, void* ctx)
+{
+    struct recview* v = ctx;
+    size_t at = v->base + i * recordSize;
+    int k = snprintf(buf, nbuf, "%08zx", at);
+    for(size_t j = 0; j < nfields && k >= 0 && (size_t)k < nbuf; ++j) {
+        const struct field* f = &fields[j];
+        char val[32];
+        record_format(record_key(mem + at + f->offset, f->width, f->be, f->type),
+                f->width, f->type, val, sizeof(val));
+        k += snprintf(buf + k, nbuf - k, "  %*s", v->columns[j], val);
+    }
+}
+
+// statistics of every field over the records in view
+struct fieldstats {
+    size_t count;
+    uint64_t min, max;
+    double sum;
+    size_t distinct;
+    int exact;
+};
+
+/* one field's statistics */
+static void fieldstats_row(size_t i, char* buf, size_t nbuf, void* ctx)
+{
+    struct fieldstats* st = &((struct fieldstats*)ctx)[i];
+    const struct field* f = &fields[i];
+    char label[32], lo[32], hi[32];
+    field_label(f, label, sizeof(label));
+    if(st->count == 0) {
+        snprintf(buf, nbuf, "%-10s  no values", label);
+        return;
+    }
+    record_format(st->min, f->width, f->type, lo, sizeof(lo));
+    record_format(st->max, f->width, f->type, hi, sizeof(hi));
+    snprintf(buf, nbuf, "%-10s  n %zu  min %s  max %s  sum %.15g  distinct %s%zu",
+            label, st->count, lo, hi, st->sum, st->exact ? "" : "~", st->distinct);
+}
+
+/* works out the statistics of every field and shows them */
+static void record_stats(struct recview* v)
+{
+    struct fieldstats* st = calloc(nfields, sizeof(struct fieldstats));
+    if(!st) return;
+    mvhline(LINES - 1, 0, ' ', COLS);
+    mvprintw(LINES - 1, 0, "Working out statistics of %zu records...", v->n);
+    refresh();
+    struct probe p = probe_begin(STAT_SEARCH);
+    for(size_t j = 0; j < nfields; ++j) {
+        const struct field* f = &fields[j];
+        int r = records_stats(mem + v->base, v->n, recordSize,
+                f->offset, f->width, f->be, f->type,
+                &st[j].count, &st[j].min, &st[j].max, &st[j].sum,
+                &st[j].distinct);
+        if(r == 0) {
+            free(st);
+            mvhline(LINES - 1, 0, ' ', COLS);
+            mvprintw(LINES - 1, 0, "Not enough memory");
+            getkey();
+            return;
+        }
+        st[j].exact = (r == 1);
+    }
+    p.bytes = v->n * recordSize;
+    probe_end(p);
+
+    char title[128];
+    snprintf(title, sizeof(title), "Statistics of %zu records of %zu bytes at %zx",
+            v->n, recordSize, v->base);
+    size_t sel = 0;
+    browse_list(title, nfields, fieldstats_row, st, NULL, &sel);
+    free(st);
+}
+
+/* asks for a record layout and a region, and lists the records in it, a
+   row each with their fields decoded; s shows statistics of the fields,
+   ENTER jumps to a record */
+void record_view(void)
+{
+    if(memsize == 0) return;
+    if(!read_layout()) return;
+    char over = read_key("Records over the w)hole buffer or between m)arkers? ", "wm");
+    if(!over) return;
+
+    size_t a1 = 0, a2 = memsize - 1;
+    if(over == 'm') {
+        if(!read_pair_of_markers(&a1, &a2)) return;
+        if(a2 >= memsize) a2 = memsize - 1;
+        if(a1 > a2) a1 = a2;
+    }
+    struct recview v = { a1, (a2 - a1 + 1) / recordSize, NULL };
+    if(v.n == 0) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Not even one %zu byte record fits in there", recordSize);
+        return;
+    }
+    v.columns = malloc(nfields * sizeof(int));
+    if(!v.columns) return;
+
+    // every column is wide enough for its values and its label
+    for(size_t j = 0; j < nfields; ++j) {
+        char label[32];
+        field_label(&fields[j], label, sizeof(label));
+        int w = field_columns(&fields[j]);
+        if((int)strlen(label) > w) w = (int)strlen(label);
+        v.columns[j] = w;
+    }
+
+    // the header lines up with the columns, as far as it goes
+    char title[256];
+    int k = snprintf(title, sizeof(title), "%-8s", "address");
+    for(size_t j = 0; j < nfields && k >= 0 && (size_t)k < sizeof(title); ++j) {
+        char label[32];
+        field_label(&fields[j], label, sizeof(label));
+        k += snprintf(title + k, sizeof(title) - k, "  %*s", v.columns[j], label);
+    }
+
+    // start at the record under the cursor
+    size_t sel = 0;
+    if(memoffset >= a1 && memoffset - a1 < v.n * recordSize) {
+        sel = (memoffset - a1) / recordSize;
+    }
+    for(;;) {
+        int c = browse_list(title, v.n, record_row, &v, "s", &sel);
+        if(c == 's') {
+            record_stats(&v);
+            continue;
+        }
+        if(c == '\n') {
+            memoffset = a1 + sel * recordSize;
+            lownibble = 0;
+            adjust_window();
+        }
+        break;
+    }
+    free(v.columns);
+    redraw();
+}
+
+/* asks for a pair of markers, a record size and a field, and sorts the
+   records in between by that field, dropping duplicates if asked to.
+   Whatever's left over past the last whole record stays put */
+void sort_records(void)
+{
+    if(memsize == 0) return;
+    size_t a1, a2;
+    if(!read_pair_of_markers(&a1, &a2)) return;
+    if(a2 >= memsize) a2 = memsize - 1;
+    if(a1 > a2) a1 = a2;
+    size_t size = read_record_size();
+    if(size == 0) return;
+    struct field f;
+    if(!read_field("Sort by", size, &f)) return;
+    char dups = read_key("Keep a)ll, drop records with the same k)ey, or identical r)ecords? ", "akr");
+    if(!dups) return;
+    recordSize = size;
+
+    size_t n = (a2 - a1 + 1) / size;
+    if(n == 0) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Not even one %zu byte record fits in there", size);
+        return;
+    }
+    mvhline(LINES - 1, 0, ' ', COLS);
+    mvprintw(LINES - 1, 0, "Sorting %zu records...", n);
+    refresh();
+    struct probe p = probe_begin(STAT_SEARCH);
+    size_t kept = records_sort(mem + a1, n, size, f.offset, f.width, f.be, f.type, dups);
+    p.bytes = n * size;
+    probe_end(p);
+    if(kept == SIZE_MAX) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Not enough memory to sort %zu records", n);
+        return;
+    }
+
+    // the duplicates went, so the rest of the buffer moves up
+    size_t gone = (n - kept) * size;
+    if(gone) {
+        size_t end = a1 + n * size;
+        memmove(mem + end - gone, mem + end, memsize - end);
+        memsize -= gone;
+        if(dirty) dirty_delete(dirty, end - gone, gone);
+        mem_changed(a1, a1 + kept * size);
+        mem_changed(end - gone, SIZE_MAX);
+
+        // whatever pointed past the records moves with the bytes; whatever
+        // pointed into the dropped tail points just past the kept records
+        for(int m = 0; m < 26; ++m) {
+            if(markers[m] >= end) markers[m] -= gone;
+            else if(markers[m] >= end - gone) markers[m] = end - gone;
+        }
+        if(memoffset >= end) memoffset -= gone;
+        else if(memoffset >= end - gone) memoffset = end - gone;
+        if(memoffset >= memsize) memoffset = memsize ? memsize - 1 : 0;
+        adjust_screen();
+    } else {
+        mem_changed(a1, a1 + kept * size);
+    }
+
+    repaint();
+    update_details();
+    update_status();
+    mvhline(LINES - 1, 0, ' ', COLS);
+    if(gone) {
+        mvprintw(LINES - 1, 0, "Sorted %zu records, dropped %zu duplicates", kept, n - kept);
+    } else {
+        mvprintw(LINES - 1, 0, "Sorted %zu records", n);
+    }
+}
+
+/* asks for a record size, the field the records are sorted by, a value
+   and the whole buffer or a pair of markers, and bisects its way to the
+   record with that value, or the nearest one */
+void bisect_records(void)
+{
+    if(memsize == 0) return;
+    size_t size = read_record_size();
+    if(size == 0) return;
+    struct field f;
+    if(!read_field("Sorted by", size, &f)) return;
+    recordSize = size;
+
+    char label[32], prompt[64];
+    field_label(&f, label, sizeof(label));
+    snprintf(prompt, sizeof(prompt), "Find %s: ", label);
+    char* s = read_string(prompt);
+    update_status();
+    if(!s) return;
+    uint64_t key;
+    int ok = record_parse(s, f.width, f.type, &key);
+    if(!ok) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "%s isn't a %s", s, label);
+        free(s);
+        return;
+    }
+    free(s);
+
+    char over = read_key("Records over the w)hole buffer or between m)arkers? ", "wm");
+    if(!over) return;
+    size_t a1 = 0, a2 = memsize - 1;
+    if(over == 'm') {
+        if(!read_pair_of_markers(&a1, &a2)) return;
+        if(a2 >= memsize) a2 = memsize - 1;
+        if(a1 > a2) a1 = a2;
+    }
+    size_t n = (a2 - a1 + 1) / size;
+    if(n == 0) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Not even one %zu byte record fits in there", size);
+        return;
+    }
+
+    int exact, probes;
+    size_t i = records_bisect(mem + a1, n, size, f.offset, f.width, f.be, f.type,
+            key, &exact, &probes);
+    memoffset = a1 + i * size;
+    lownibble = 0;
+    adjust_screen();
+    update_details();
+    update_status();
+
+    char val[32];
+    record_format(record_key(mem + memoffset + f.offset, f.width, f.be, f.type),
+            f.width, f.type, val, sizeof(val));
+    mvhline(LINES - 1, 0, ' ', COLS);
+    mvprintw(LINES - 1, 0, "%s record %zu of %zu, %s = %s, after looking at %d",
+            exact ? "Found" : "Nearest is", i, n, label, val, probes);
+}
+
+// the periods ^ found
+#define MAX_PERIODS 10
+struct periods {
+    size_t lags[MAX_PERIODS];
+    double scores[MAX_PERIODS];
+};
+
+/* one candidate period */
+static void period_row(size_t i, char* buf, size_t nbuf, void* ctx)
+{
+    struct periods* p = ctx;
+    char bar[41];
+    int n = (int)(p->scores[i] * 40 + 0.5);
+    memset(bar, '#', n);
+    bar[n] = '\0';
+    snprintf(buf, nbuf, "%8zu bytes  %5.1f%%  %s", p->lags[i], 100 * p->scores[i], bar);
+}
+
+/* asks for the whole buffer or a pair of markers and the longest period
+   to look for, and lists the likeliest record sizes; ENTER makes one the
+   record size for v, s and t */
+void find_period(void)
+{
+    if(memsize == 0) return;
+    char over = read_key("Look at the w)hole buffer or between m)arkers? ", "wm");
+    if(!over) return;
+    size_t a1 = 0, a2 = memsize - 1;
+    if(over == 'm') {
+        if(!read_pair_of_markers(&a1, &a2)) return;
+        if(a2 >= memsize) a2 = memsize - 1;
+        if(a1 > a2) a1 = a2;
+    }
+    char* s = read_string("Longest period [4096]: ");
+    update_status();
+    size_t maxlag = 4096;
+    if(s) {
+        maxlag = 0;
+        sscanf(s, "%zi", &maxlag);
+        free(s);
+    }
+    size_t n = a2 - a1 + 1;
+    if(maxlag > 65536) maxlag = 65536;
+    if(maxlag > n / 2) maxlag = n / 2;
+    if(maxlag < 2) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "That's too short to repeat");
+        return;
+    }
+
+    mvhline(LINES - 1, 0, ' ', COLS);
+    mvprintw(LINES - 1, 0, "Looking for periods of up to %zu bytes...", maxlag);
+    refresh();
+    struct periods p;
+    double base;
+    struct probe pr = probe_begin(STAT_SEARCH);
+    size_t found = period_find(mem + a1, n, maxlag, MAX_PERIODS, p.lags, p.scores, &base);
+    pr.bytes = n;
+    probe_end(pr);
+    if(found == 0) {
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Nothing repeats every 2 to %zu bytes", maxlag);
+        return;
+    }
+
+    char title[128];
+    snprintf(title, sizeof(title),
+            "Likely record sizes, scored by bytes repeating beyond the usual %.1f%%",
+            100 * base);
+    size_t sel = 0;
+    int picked = browse_list(title, found, period_row, &p, NULL, &sel) == '\n';
+    redraw();
+    if(picked) {
+        recordSize = p.lags[sel];
+        mvhline(LINES - 1, 0, ' ', COLS);
+        mvprintw(LINES - 1, 0, "Records are %zu bytes now", recordSize);
+    }
+}
@@ -19,6 +19,7 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #define MEMMAX(A, B) ((A) > (B) ? (A) : (B))
 
@@ -418,3 +419,260 @@ END:
     free(T);
     return rval;
 }
+
+/*
+ * Streaming search.
+ *
+ * The functions above want the whole haystack in one piece. The ones below
+ * keep the pattern and the partial match in a state object, so the haystack
+ * can be fed in chunks of whatever size, from wherever they live in memory.
+ * Matches that straddle chunk boundaries are still found, and nothing gets
+ * copied. Backwards searches are fed chunks from the end towards the start.
+ *
+ * Plain patterns use KMP with a precomputed failure function (the thing
+ * the comment at the top of this file was whining about).
+ * Masked patterns use shift-and instead, because two masked bytes can both
+ * match the same input without being equal to each other, and that throws
+ * KMP off.
+ */
+
+struct memsearch_stream {
+    // pattern in scan order, i.e. reversed for backwards searches
+    unsigned char* needle;
+    unsigned char* mask;
+    size_t nneedle;
+    int backwards;
+    // plain patterns: KMP failure function and current partial match length
+    size_t* F;
+    size_t i;
+    // masked patterns: bit j of D is set if needle[0..j] matches the last
+    // j+1 bytes fed; bit j of B[c] is set if byte c matches needle[j]
+    size_t nwords;
+    uint64_t* D;
+    uint64_t* B;
+};
+
+void memsearch_end(void* state);
+
+static void*
+stream_begin(void* vneedle, size_t nneedle, void* vmask, int backwards)
+{
+    unsigned char* needle = vneedle;
+    unsigned char* mask = vmask;
+
+    if(!nneedle || !needle) return NULL;
+
+    struct memsearch_stream* s = calloc(1, sizeof(struct memsearch_stream));
+    if(!s) return NULL;
+    s->nneedle = nneedle;
+    s->backwards = backwards;
+
+    s->needle = malloc(nneedle);
+    if(!s->needle) goto FAIL;
+    for(size_t j = 0; j < nneedle; ++j) {
+        s->needle[j] = backwards ? needle[nneedle - 1 - j] : needle[j];
+    }
+
+    if(mask) {
+        s->mask = malloc(nneedle);
+        if(!s->mask) goto FAIL;
+        for(size_t j = 0; j < nneedle; ++j) {
+            s->mask[j] = backwards ? mask[nneedle - 1 - j] : mask[j];
+        }
+
+        s->nwords = (nneedle + 63) / 64;
+        s->D = calloc(s->nwords, sizeof(uint64_t));
+        s->B = calloc(256 * s->nwords, sizeof(uint64_t));
+        if(!s->D || !s->B) goto FAIL;
+        for(unsigned c = 0; c < 256; ++c) {
+            uint64_t* Bc = s->B + c * s->nwords;
+            for(size_t j = 0; j < nneedle; ++j) {
+                if(masked_equals(c, s->needle[j], s->mask[j]))
+                    Bc[j / 64] |= (uint64_t)1 << (j % 64);
+            }
+        }
+    } else {
+        // F[j] is the length of the longest proper prefix of needle[0..j)
+        // which is also a suffix of it
+        s->F = calloc(nneedle + 1, sizeof(size_t));
+        if(!s->F) goto FAIL;
+        size_t k = 0;
+        for(size_t j = 1; j < nneedle; ++j) {
+            while(k > 0 && s->needle[j] != s->needle[k]) k = s->F[k];
+            if(s->needle[j] == s->needle[k]) ++k;
+            s->F[j + 1] = k;
+        }
+    }
+
+    return s;
+
+FAIL:
+    memsearch_end(s);
+    return NULL;
+}
+
+/** memsearch_begin
+  *
+  * Starts a streaming forward search for needle[nneedle].
+  * The needle is copied, so the caller may free it.
+  *
+  * Returns a state to pass to memsearch_feed(), or NULL if the needle
+  * is empty or we ran out of memory. Free it with memsearch_end().
+  */
+void*
+memsearch_begin(void* needle, size_t nneedle)
+{
+    return stream_begin(needle, nneedle, NULL, 0);
+}
+
+/** rmemsearch_begin
+  *
+  * Like memsearch_begin(), but searches backwards. Feed it chunks
+  * starting from the end of the haystack.
+  */
+void*
+rmemsearch_begin(void* needle, size_t nneedle)
+{
+    return stream_begin(needle, nneedle, NULL, 1);
+}
+
+/** bpatmemsearch_begin
+  *
+  * Like memsearch_begin(), but compares with a bitmask, see bpatmemsearch().
+  */
+void*
+bpatmemsearch_begin(void* needle, size_t nneedle, void* mask)
+{
+    if(!mask) return NULL;
+    return stream_begin(needle, nneedle, mask, 0);
+}
+
+/** bpatrmemsearch_begin
+  *
+  * Like bpatmemsearch_begin(), but searches backwards.
+  */
+void*
+bpatrmemsearch_begin(void* needle, size_t nneedle, void* mask)
+{
+    if(!mask) return NULL;
+    return stream_begin(needle, nneedle, mask, 1);
+}
+
+/** memsearch_feed
+  *
+  * Feeds the next chunk of the haystack to a streaming search.
+  *
+  * state                   what one of the *_begin functions returned
+  * chunk[nchunk]           the next piece of the haystack
+  * consumed                receives how many bytes of chunk were looked at
+  *
+  * Forward searches look at chunk from the start; backward searches
+  * look at it from the end.
+  *
+  * Returns a pointer to the byte of chunk which completed a match, or NULL
+  * if the whole chunk was consumed without finding one. For forward
+  * searches that is the *last* byte of the match, for backward searches
+  * it is the *first* one; the rest of the match may sit in chunks fed
+  * earlier.
+  *
+  * After a match, feed the rest of the chunk to keep going, i.e.
+  * chunk + consumed for forward searches and chunk for backward ones,
+  * with nchunk - consumed bytes in both cases. Overlapping matches are
+  * reported.
+  */
+void*
+memsearch_feed(void* state, void* vchunk, size_t nchunk, size_t* consumed)
+{
+    struct memsearch_stream* s = state;
+    unsigned char* chunk = vchunk;
+    size_t k = 0;
+
+    // chunk[at(k)] is the k-th byte we look at
+#define at(k) (s->backwards ? nchunk - 1 - (k) : (k))
+
+    if(s->mask) {
+        uint64_t last = (uint64_t)1 << ((s->nneedle - 1) % 64);
+        uint64_t* D = s->D;
+        size_t nwords = s->nwords;
+        while(k < nchunk) {
+            uint64_t* Bc = s->B + chunk[at(k)] * nwords;
+            uint64_t carry = 1;
+            for(size_t w = 0; w < nwords; ++w) {
+                uint64_t d = D[w];
+                D[w] = ((d << 1) | carry) & Bc[w];
+                carry = d >> 63;
+            }
+            ++k;
+            if(D[nwords - 1] & last) {
+                *consumed = k;
+                return &chunk[at(k - 1)];
+            }
+        }
+    } else {
+        unsigned char* needle = s->needle;
+        size_t i = s->i;
+        while(k < nchunk) {
+            // nothing matched so far; skip ahead to the next byte that
+            // could start a match
+            if(i == 0) {
+                if(!s->backwards) {
+                    unsigned char* p = memchr(chunk + k, needle[0], nchunk - k);
+                    if(!p) {
+                        k = nchunk;
+                        break;
+                    }
+                    k = p - chunk;
+                } else {
+                    while(k < nchunk && chunk[at(k)] != needle[0]) ++k;
+                    if(k == nchunk) break;
+                }
+            }
+
+            unsigned char c = chunk[at(k)];
+            while(i > 0 && needle[i] != c) i = s->F[i];
+            if(needle[i] == c) ++i;
+            ++k;
+
+            if(i == s->nneedle) {
+                s->i = s->F[i];
+                *consumed = k;
+                return &chunk[at(k - 1)];
+            }
+        }
+        s->i = i;
+    }
+
+#undef at
+
+    *consumed = nchunk;
+    return NULL;
+}
+
+/** memsearch_reset
+  *
+  * Forgets any partial match, as if no chunks were fed so far.
+  */
+void
+memsearch_reset(void* state)
+{
+    struct memsearch_stream* s = state;
+    s->i = 0;
+    if(s->D) memset(s->D, 0, s->nwords * sizeof(uint64_t));
+}
+
+/** memsearch_end
+  *
+  * Frees a streaming search state. NULL is fine.
+  */
+void
+memsearch_end(void* state)
+{
+    struct memsearch_stream* s = state;
+    if(!s) return;
+    free(s->needle);
+    free(s->mask);
+    free(s->F);
+    free(s->D);
+    free(s->B);
+    free(s);
+}
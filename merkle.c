@@ -0,0 +1,274 @@
+/*
+Copyright 2024 Vlad Mesco
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+// Hash tree over the buffer, to tell cheaply which parts of it changed
+// since it was loaded, saved or checkpointed.
+//
+// Level 0 has the xxHash64 of every 64KiB block; every level above has
+// the hash of the hashes of up to 16 nodes of the one below, up to a
+// single root. Two trees are compared top down, only going into nodes
+// whose hashes differ, so unchanged stretches of the buffer cost one
+// comparison per node rather than one per block. Building a tree is one
+// parallel pass over the buffer; after that, edits rehash the blocks they
+// touch and their parents.
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+extern void
+run_parallel(size_t, void (*)(size_t, void*), void*);
+extern uint64_t
+hash_xxh64(const unsigned char*, size_t);
+
+#define SHIFT0 16       // 64KiB
+#define FANOUT 4        // 16 children per parent
+#define MAXLEVELS 16
+#define JOB_BLOCKS 64   // blocks hashed per parallel job
+
+struct merkle {
+    size_t size;                // bytes covered
+    int nlevels;
+    size_t n[MAXLEVELS];
+    uint64_t* h[MAXLEVELS];
+};
+
+struct hash_job {
+    struct merkle* t;
+    const unsigned char* mem;
+    size_t from, to;
+};
+
+static void hash_blocks(size_t job, void* vctx)
+{
+    struct hash_job* j = vctx;
+    size_t b0 = j->from + job * JOB_BLOCKS;
+    size_t b1 = b0 + JOB_BLOCKS;
+    if(b1 > j->to) b1 = j->to;
+    for(size_t b = b0; b < b1; ++b) {
+        size_t off = b << SHIFT0;
+        size_t n = j->t->size - off;
+        if(n > (1u << SHIFT0)) n = 1u << SHIFT0;
+        j->t->h[0][b] = hash_xxh64(j->mem + off, n);
+    }
+}
+
+// rehash the parents of level 0 nodes [from, to)
+static void aggregate(struct merkle* t, size_t from, size_t to)
+{
+    for(int l = 1; l < t->nlevels; ++l) {
+        from >>= FANOUT;
+        to = (to + (1u << FANOUT) - 1) >> FANOUT;
+        if(to > t->n[l]) to = t->n[l];
+        for(size_t b = from; b < to; ++b) {
+            size_t k0 = b << FANOUT;
+            size_t k1 = k0 + (1u << FANOUT);
+            if(k1 > t->n[l - 1]) k1 = t->n[l - 1];
+            // the number of children counts too, through the length
+            t->h[l][b] = hash_xxh64((const unsigned char*)&t->h[l - 1][k0],
+                    (k1 - k0) * sizeof(uint64_t));
+        }
+    }
+}
+
+void merkle_free(void* vt);
+
+// (re)allocate the levels for a buffer of size bytes. Returns 0 if out of memory
+static int resize(struct merkle* t, size_t size)
+{
+    size_t n = (size + (1u << SHIFT0) - 1) >> SHIFT0;
+    if(n == 0) n = 1;
+    int l = 0;
+    for(;;) {
+        if(l == MAXLEVELS) return 0;
+        if(n != t->n[l] || !t->h[l]) {
+            void* p = realloc(t->h[l], n * sizeof(uint64_t));
+            if(!p) return 0;
+            t->h[l] = p;
+            t->n[l] = n;
+        }
+        ++l;
+        if(n == 1) break;
+        n = (n + (1u << FANOUT) - 1) >> FANOUT;
+    }
+    for(int k = l; k < t->nlevels; ++k) {
+        free(t->h[k]);
+        t->h[k] = NULL;
+        t->n[k] = 0;
+    }
+    t->nlevels = l;
+    t->size = size;
+    return 1;
+}
+
+/** merkle_update
+  *
+  * Brings the tree up to date after bytes [a1, a2) of the buffer changed.
+  * a2 may be past the end, e.g. SIZE_MAX when everything from a1 onwards
+  * moved. The buffer may have changed size.
+  *
+  * Returns 0 if we ran out of memory, in which case the tree is garbage
+  * and should be freed.
+  */
+int
+merkle_update(void* vt, const unsigned char* mem, size_t size, size_t a1, size_t a2)
+{
+    struct merkle* t = vt;
+    if(!resize(t, size)) return 0;
+
+    size_t from = a1 >> SHIFT0;
+    size_t to = (a2 >= size) ? t->n[0] : ((a2 + (1u << SHIFT0) - 1) >> SHIFT0);
+    if(to > t->n[0]) to = t->n[0];
+    if(size == 0) {
+        t->h[0][0] = hash_xxh64(mem, 0);
+        from = 0;
+        to = 1;
+    } else if(from < to) {
+        struct hash_job j = { t, mem, from, to };
+        size_t njobs = (to - from + JOB_BLOCKS - 1) / JOB_BLOCKS;
+        if(njobs > 1) run_parallel(njobs, hash_blocks, &j);
+        else hash_blocks(0, &j);
+    }
+    aggregate(t, from, to);
+    return 1;
+}
+
+/** merkle_build
+  *
+  * Hashes mem[size]. Returns NULL if we ran out of memory.
+  * Free it with merkle_free().
+  */
+void*
+merkle_build(const unsigned char* mem, size_t size)
+{
+    struct merkle* t = calloc(1, sizeof(struct merkle));
+    if(!t) return NULL;
+    if(!merkle_update(t, mem, size, 0, SIZE_MAX)) {
+        merkle_free(t);
+        return NULL;
+    }
+    return t;
+}
+
+/** merkle_copy
+  *
+  * Returns a copy of a tree, e.g. to compare against later, or NULL if we
+  * ran out of memory.
+  */
+void*
+merkle_copy(void* vt)
+{
+    struct merkle* t = vt;
+    struct merkle* c = calloc(1, sizeof(struct merkle));
+    if(!c) return NULL;
+    c->size = t->size;
+    c->nlevels = t->nlevels;
+    for(int l = 0; l < t->nlevels; ++l) {
+        c->n[l] = t->n[l];
+        c->h[l] = malloc(t->n[l] * sizeof(uint64_t));
+        if(!c->h[l]) {
+            merkle_free(c);
+            return NULL;
+        }
+        memcpy(c->h[l], t->h[l], t->n[l] * sizeof(uint64_t));
+    }
+    return c;
+}
+
+/** merkle_free
+  *
+  * Frees a tree. NULL is fine.
+  */
+void
+merkle_free(void* vt)
+{
+    struct merkle* t = vt;
+    if(!t) return;
+    for(int l = 0; l < MAXLEVELS; ++l) free(t->h[l]);
+    free(t);
+}
+
+/** merkle_block_size
+  *
+  * Returns the number of bytes hashed together at the bottom of the tree.
+  */
+size_t
+merkle_block_size(void)
+{
+    return 1u << SHIFT0;
+}
+
+/** merkle_size
+  *
+  * Returns the size of the buffer the tree was built or updated for.
+  */
+size_t
+merkle_size(void* vt)
+{
+    return ((struct merkle*)vt)->size;
+}
+
+struct walk {
+    struct merkle* a;
+    struct merkle* b;
+    size_t nblocks;     // in the bigger of the two
+    void (*cb)(size_t, void*);
+    void* ctx;
+    size_t count;
+};
+
+// node i of level l, in both trees if they have it; the hashes of a block
+// or of a parent depend on how long it is, so equal hashes mean equal
+// subtrees even where one tree ends
+static void walk(struct walk* w, int l, size_t i)
+{
+    if(l < w->a->nlevels && l < w->b->nlevels
+            && i < w->a->n[l] && i < w->b->n[l]
+            && w->a->h[l][i] == w->b->h[l][i]) {
+        return;
+    }
+    if(l == 0) {
+        if(i < w->nblocks) {
+            w->count++;
+            if(w->cb) w->cb(i, w->ctx);
+        }
+        return;
+    }
+    size_t k0 = i << FANOUT;
+    for(size_t k = k0; k < k0 + (1u << FANOUT); ++k) {
+        if((k << (FANOUT * (l - 1))) >= w->nblocks) break;
+        walk(w, l - 1, k);
+    }
+}
+
+/** merkle_diff
+  *
+  * Compares two trees and calls cb(block, ctx) for every block which
+  * differs between them, in increasing order; a block which is only in
+  * one of them differs. cb may be NULL. Returns the number of blocks
+  * which differ.
+  */
+size_t
+merkle_diff(void* va, void* vb, void (*cb)(size_t, void*), void* ctx)
+{
+    struct merkle* a = va;
+    struct merkle* b = vb;
+    struct walk w = { a, b, 0, cb, ctx, 0 };
+    size_t na = (a->size + (1u << SHIFT0) - 1) >> SHIFT0;
+    size_t nb = (b->size + (1u << SHIFT0) - 1) >> SHIFT0;
+    w.nblocks = (na > nb) ? na : nb;
+    if(w.nblocks == 0) return 0;
+    int top = (a->nlevels > b->nlevels) ? a->nlevels : b->nlevels;
+    walk(&w, top - 1, 0);
+    return w.count;
+}
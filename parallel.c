@@ -0,0 +1,109 @@
+/*
+Copyright 2024 Vlad Mesco
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// NOLINTBEGIN
+#ifndef _XOPEN_SOURCE
+# define _XOPEN_SOURCE 600
+#endif
+// NOLINTEND
+
+// A poor man's thread pool. Spawns some threads, hands out job numbers
+// to whoever asks first, and waits for everyone to be done. There's no
+// persistent pool because jobs are big (files, megabytes of memory) and
+// thread creation is noise compared to that.
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+struct parallel_state {
+    pthread_mutex_t lock;
+    size_t next;
+    size_t njobs;
+    void (*job)(size_t, void*);
+    void* ctx;
+};
+
+static void* worker(void* p)
+{
+    struct parallel_state* st = p;
+    for(;;) {
+        pthread_mutex_lock(&st->lock);
+        size_t i = st->next;
+        if(i < st->njobs) st->next++;
+        pthread_mutex_unlock(&st->lock);
+
+        if(i >= st->njobs) break;
+        st->job(i, st->ctx);
+    }
+    return NULL;
+}
+
+/** ncpus
+  *
+  * Returns the number of online processors, or 1 if we can't tell.
+  */
+int
+ncpus(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if(n > 0) return (int)n;
+#endif
+    return 1;
+}
+
+/** run_parallel
+  *
+  * Calls job(i, ctx) for every i in [0, njobs) and returns once all of
+  * them are done. Jobs run on up to ncpus() threads, the calling thread
+  * being one of them. Jobs are handed out one at a time in increasing
+  * order, so uneven jobs balance out.
+  *
+  * If threads can't be created, whatever is left runs on the calling
+  * thread, so all jobs always run.
+  */
+void
+run_parallel(size_t njobs, void (*job)(size_t, void*), void* ctx)
+{
+    struct parallel_state st;
+    st.next = 0;
+    st.njobs = njobs;
+    st.job = job;
+    st.ctx = ctx;
+
+    size_t nthreads = (size_t)ncpus();
+    if(nthreads > njobs) nthreads = njobs;
+    if(nthreads <= 1) {
+        for(size_t i = 0; i < njobs; ++i) job(i, ctx);
+        return;
+    }
+
+    pthread_mutex_init(&st.lock, NULL);
+
+    pthread_t* threads = malloc(sizeof(pthread_t) * (nthreads - 1));
+    size_t nstarted = 0;
+    if(threads) {
+        for(; nstarted < nthreads - 1; ++nstarted) {
+            if(pthread_create(&threads[nstarted], NULL, worker, &st) != 0)
+                break;
+        }
+    }
+
+    worker(&st);
+
+    for(size_t i = 0; i < nstarted; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    pthread_mutex_destroy(&st.lock);
+}
@@ -0,0 +1,230 @@
+/*
+Copyright 2024 Vlad Mesco
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+// Finding the record size of a blob: for every lag up to some maximum,
+// count how many bytes are the same as the byte lag bytes later. Arrays of
+// records repeat their padding, flags and high bytes every record, so the
+// record size and its multiples stand out.
+//
+// A few hundred MiB would take a while, so it looks at SAMPLE bytes spread
+// out over the range in WINDOWS windows, fewer if the lags go far out.
+// Lags are split between parallel jobs. Counting goes 16 bytes at a time
+// with SSE2, 8 at a time in 64 bit words otherwise.
+//
+// Bytes which match at any lag are taken out: if the sample is mostly
+// zeros, most bytes match whatever the lag, and fields which hardly change
+// match across records whatever the lag is too. So the baseline is how
+// often bytes match at the median lag, or by chance going by how common
+// every byte is, if that's more. A lag's score is how much more often
+// bytes match than that, from 0 to 1. Multiples of a period score about as
+// well as it does, so a lag doesn't get reported if one of its divisors
+// scores nearly as well. Nor do lags which do much worse than the best,
+// which are mostly the period give or take a byte or two, e.g. where two
+// bytes of padding are next to each other.
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+extern void
+run_parallel(size_t, void (*)(size_t, void*), void*);
+
+#define SAMPLE (1u << 20)
+#define MINSAMPLE (64u << 10)
+#define WINDOWS 16
+#define WORK (1ull << 32)       // bytes compared, at most
+#define LAGSPERJOB 64
+#define HARMONIC 0.9            // how well a divisor has to do
+#define MINSCORE 0.01           // below this it's noise
+#define RELATIVE 0.34           // ... and so is a third of the best or less
+#define LO7 0x7F7F7F7F7F7F7F7Full
+#define HI1 0x8080808080808080ull
+
+static int cmp_double(const void* va, const void* vb)
+{
+    double a = *(const double*)va;
+    double b = *(const double*)vb;
+    return (a > b) - (a < b);
+}
+
+struct corr {
+    const unsigned char* p;     // the windows, one after the other
+    size_t len;                 // bytes counted in every window
+    size_t stride;              // len + maxlag
+    size_t nwin;
+    size_t maxlag;
+    uint64_t* matches;          // by lag
+};
+
+// how many of a[0, n) are the same as b[0, n)
+static uint64_t count_equal(const unsigned char* a, const unsigned char* b, size_t n)
+{
+    uint64_t count = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    while(i + 16 <= n) {
+        // every byte counts up to 255 before they get added up
+        __m128i acc = zero;
+        size_t end = i + 255 * 16;
+        if(end > n) end = n;
+        for(; i + 16 <= end; i += 16) {
+            __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)),
+                    _mm_loadu_si128((const __m128i*)(b + i)));
+            acc = _mm_sub_epi8(acc, eq);
+        }
+        __m128i sums = _mm_sad_epu8(acc, zero);
+        count += (uint64_t)_mm_cvtsi128_si32(sums)
+            + (uint64_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+    }
+#else
+    for(; i + 8 <= n; i += 8) {
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        x ^= y;
+        // the top bit of every byte which is zero, i.e. matched
+        uint64_t z = ~(((x & LO7) + LO7) | x) & HI1;
+        count += ((z >> 7) * 0x0101010101010101ull) >> 56;
+    }
+#endif
+    for(; i < n; ++i) count += a[i] == b[i];
+    return count;
+}
+
+static void corr_job(size_t j, void* ctx)
+{
+    struct corr* c = ctx;
+    size_t first = 1 + j * LAGSPERJOB;
+    size_t last = first + LAGSPERJOB;
+    if(last > c->maxlag + 1) last = c->maxlag + 1;
+    for(size_t lag = first; lag < last; ++lag) {
+        uint64_t m = 0;
+        for(size_t w = 0; w < c->nwin; ++w) {
+            const unsigned char* p = c->p + w * c->stride;
+            m += count_equal(p, p + lag, c->len);
+        }
+        c->matches[lag] = m;
+    }
+}
+
+/** period_find
+  *
+  * Looks for periods of up to maxlag bytes in p[0, n), which must be at
+  * least twice that long. Puts the best of them, at most k, in lags[],
+  * best first, with their scores from 0 to 1 in scores[], and sets
+  * *pbase to the fraction of bytes which match at any lag anyway.
+  * Returns how many it found; 0 if there are none, or if we ran out of
+  * memory.
+  */
+size_t
+period_find(const unsigned char* p, size_t n, size_t maxlag, size_t k,
+        size_t* lags, double* scores, double* pbase)
+{
+    if(maxlag < 2 || n < 2 * maxlag) return 0;
+
+    // gather up the windows, unless the whole thing is small enough
+    size_t sample = SAMPLE;
+    while(sample > MINSAMPLE && (uint64_t)sample * maxlag > WORK) sample /= 2;
+    struct corr c = { p, 0, 0, 1, maxlag, NULL };
+    unsigned char* copy = NULL;
+    if(n - maxlag <= sample) {
+        c.len = n - maxlag;
+        c.stride = n;
+    } else {
+        c.nwin = WINDOWS;
+        c.len = sample / WINDOWS;
+        c.stride = c.len + maxlag;
+        while(c.nwin > 1 && c.nwin * c.stride > n) --c.nwin;
+        copy = malloc(c.nwin * c.stride);
+        if(!copy) return 0;
+        size_t gap = (n - c.stride) / (c.nwin - (c.nwin > 1));
+        for(size_t w = 0; w < c.nwin; ++w) {
+            memcpy(copy + w * c.stride, p + w * gap, c.stride);
+        }
+        c.p = copy;
+    }
+
+    c.matches = calloc(maxlag + 1, sizeof(uint64_t));
+    double* score = calloc(maxlag + 1, sizeof(double));
+    char* harmonic = calloc(maxlag + 1, 1);
+    if(!c.matches || !score || !harmonic) {
+        free(copy);
+        free(c.matches);
+        free(score);
+        free(harmonic);
+        return 0;
+    }
+
+    size_t njobs = (maxlag + LAGSPERJOB - 1) / LAGSPERJOB;
+    if(njobs > 1) run_parallel(njobs, corr_job, &c);
+    else corr_job(0, &c);
+
+    // the odds of two bytes of the sample matching by chance
+    uint64_t hist[256] = { 0 };
+    for(size_t w = 0; w < c.nwin; ++w) {
+        const unsigned char* q = c.p + w * c.stride;
+        for(size_t i = 0; i < c.len; ++i) hist[q[i]]++;
+    }
+    double total = (double)(c.len * c.nwin);
+    double chance = 0;
+    for(int b = 0; b < 256; ++b) chance += ((double)hist[b] / total) * ((double)hist[b] / total);
+
+    for(size_t lag = 1; lag <= maxlag; ++lag) {
+        score[lag] = (double)c.matches[lag] / total;
+    }
+    // sort a copy for the median; the matches are done with by now
+    double* sorted = (double*)c.matches;
+    memcpy(sorted, score + 1, maxlag * sizeof(double));
+    qsort(sorted, maxlag, sizeof(double), cmp_double);
+    double base = sorted[maxlag / 2];
+    if(base < chance) base = chance;
+    for(size_t lag = 1; lag <= maxlag; ++lag) {
+        score[lag] = (base < 1.0) ? (score[lag] - base) / (1.0 - base) : 0.0;
+        if(score[lag] < 0) score[lag] = 0;
+    }
+    // a period of 1 is a run, not a record
+    for(size_t d = 2; d <= maxlag; ++d) {
+        for(size_t m = 2 * d; m <= maxlag; m += d) {
+            if(score[d] >= HARMONIC * score[m]) harmonic[m] = 1;
+        }
+    }
+
+    double best = 0;
+    for(size_t lag = 2; lag <= maxlag; ++lag) {
+        if(score[lag] > best) best = score[lag];
+    }
+    size_t found = 0;
+    for(size_t lag = 2; lag <= maxlag; ++lag) {
+        if(harmonic[lag] || score[lag] < MINSCORE || score[lag] < RELATIVE * best) continue;
+        // insert it where it goes among the best so far
+        size_t at = found;
+        while(at > 0 && scores[at - 1] < score[lag]) --at;
+        if(at >= k) continue;
+        if(found < k) ++found;
+        memmove(lags + at + 1, lags + at, (found - 1 - at) * sizeof(size_t));
+        memmove(scores + at + 1, scores + at, (found - 1 - at) * sizeof(double));
+        lags[at] = lag;
+        scores[at] = score[lag];
+    }
+    *pbase = base;
+
+    free(copy);
+    free(c.matches);
+    free(score);
+    free(harmonic);
+    return found;
+}
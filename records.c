@@ -0,0 +1,771 @@
+/*
+Copyright 2024 Vlad Mesco
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+// Fixed size records: decoding their fields, and statistics of a field
+// over many records.
+//
+// A field is 1, 2, 4 or 8 bytes at some offset into every record, little
+// or big endian, read as an unsigned (u), signed (s), hex (x) or floating
+// point (f, 4 or 8 bytes) number. Fields are turned into keys which order
+// the same way the numbers do, so whatever compares fields only ever
+// compares plain uint64_t's.
+//
+// Records are strided, so there's nothing for SIMD to load in one go. The
+// statistics gather a block of fields at a time into a contiguous array,
+// with a loop made for the field's width and endianness, and then reduce
+// the block with straight loops over the array which the compiler can
+// vectorise. The records are split into at most MAXJOBS jobs which run in
+// parallel and get merged at the end.
+//
+// Distinct counts are exact for 1 and 2 byte fields, which get a bitmap,
+// and for up to SMALL distinct values of wider ones. Past that, they're
+// a HyperLogLog estimate, which is within a percent or so.
+//
+// Sorting records sorts (key, record number) pairs: every job radix sorts
+// its share of them, a byte of the key per pass, skipping the bytes which
+// are the same everywhere; then rounds of merges, every one of which
+// merges pairs of sorted runs in parallel, put them together. Then the
+// records get gathered in the new order, in parallel, and copied back.
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+#include <errno.h>
+
+extern void
+run_parallel(size_t, void (*)(size_t, void*), void*);
+
+#define BLOCK 1024          // fields gathered at a time
+#define MAXJOBS 64
+#define MINJOB 65536        // records
+#define SMALL 1024          // distinct values counted exactly
+#define SLOTS (2 * SMALL)   // in the hash set, plus one for the all ones key
+#define HLLBITS 14
+#define TOP 0x8000000000000000ull
+
+struct part {
+    size_t from, n;         // records
+    size_t count;
+    uint64_t min, max;
+    double sum;
+    uint64_t* bits;         // 1 and 2 byte fields: every value seen
+    uint64_t* small;        // wider ones: a hash set of up to SMALL keys
+    size_t nsmall;
+    unsigned char* hll;     // ... and past that, HyperLogLog registers
+    int nomem;
+};
+
+struct stats {
+    const unsigned char* p;
+    size_t size;
+    int width, be;
+    char type;
+    struct part* parts;
+};
+
+static inline uint64_t load(const unsigned char* p, int width, int be)
+{
+    uint64_t v = 0;
+    if(be) {
+        for(int i = 0; i < width; ++i) v = (v << 8) | p[i];
+    } else {
+        for(int i = width - 1; i >= 0; --i) v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static double bits_to_double(uint64_t b)
+{
+    double d;
+    memcpy(&d, &b, 8);
+    return d;
+}
+
+static uint64_t double_to_bits(double d)
+{
+    uint64_t b;
+    memcpy(&b, &d, 8);
+    return b;
+}
+
+/** record_load
+  *
+  * Returns the width byte number at p, zero extended, little endian
+  * unless be is set. width is 1 to 8.
+  */
+uint64_t
+record_load(const unsigned char* p, int width, int be)
+{
+    return load(p, width, be);
+}
+
+// turn a block of loaded values into keys, in place
+static void to_keys(uint64_t* v, size_t n, int width, char type)
+{
+    int sh = 64 - 8 * width;
+    switch(type) {
+        case 's':
+            for(size_t i = 0; i < n; ++i) {
+                v[i] = (uint64_t)((int64_t)(v[i] << sh) >> sh) ^ TOP;
+            }
+            break;
+        case 'f':
+            for(size_t i = 0; i < n; ++i) {
+                uint64_t b = v[i];
+                if(width == 4) {
+                    float f;
+                    uint32_t b32 = (uint32_t)b;
+                    memcpy(&f, &b32, 4);
+                    b = double_to_bits((double)f);
+                }
+                // negative numbers order backwards, and below positive ones
+                v[i] = (b & TOP) ? ~b : b | TOP;
+            }
+            break;
+    }
+}
+
+/** record_key
+  *
+  * Returns the field of width bytes at p as a key, which orders like the
+  * field's value does. type is u or x for unsigned, s for signed and f
+  * for floating point. Floats come out the same as the double they're
+  * equal to.
+  */
+uint64_t
+record_key(const unsigned char* p, int width, int be, char type)
+{
+    uint64_t v = load(p, width, be);
+    to_keys(&v, 1, width, type);
+    return v;
+}
+
+/** record_value
+  *
+  * Turns a key back into a number: what the field is, if it's an integer
+  * type; and the bits of a double for floats.
+  */
+uint64_t
+record_value(uint64_t key, char type)
+{
+    switch(type) {
+        case 's': return key ^ TOP;
+        case 'f': return (key & TOP) ? key & ~TOP : ~key;
+    }
+    return key;
+}
+
+/** record_format
+  *
+  * Prints the field with the given key into buf, the way its type says.
+  */
+void
+record_format(uint64_t key, int width, char type, char* buf, size_t nbuf)
+{
+    uint64_t v = record_value(key, type);
+    switch(type) {
+        case 's':
+            snprintf(buf, nbuf, "%lld", (long long)(int64_t)v);
+            break;
+        case 'x':
+            snprintf(buf, nbuf, "%0*llx", 2 * width, (unsigned long long)v);
+            break;
+        case 'f':
+            snprintf(buf, nbuf, (width == 4) ? "%.7g" : "%.15g", bits_to_double(v));
+            break;
+        default:
+            snprintf(buf, nbuf, "%llu", (unsigned long long)v);
+            break;
+    }
+}
+
+/** record_parse
+  *
+  * Reads a number typed in for a field of the given width and type, and
+  * sets *pkey to the key a field with that value would have. Numbers go
+  * as for strtoull(), strtoll() and strtod(), except x fields, which are
+  * in hex. Returns 0 if it's not a number or doesn't fit.
+  */
+int
+record_parse(const char* s, int width, char type, uint64_t* pkey)
+{
+    char* end;
+    uint64_t v;
+    int bits = 8 * width;
+    errno = 0;
+    switch(type) {
+        case 'f': {
+            double d = strtod(s, &end);
+            if(width == 4) {
+                float f = (float)d;
+                uint32_t b;
+                memcpy(&b, &f, 4);
+                v = b;
+            } else {
+                v = double_to_bits(d);
+            }
+            break;
+        }
+        case 's': {
+            long long x = strtoll(s, &end, 0);
+            if(bits < 64 && (x < -(1ll << (bits - 1)) || x >= (1ll << (bits - 1)))) return 0;
+            v = (uint64_t)x;
+            if(bits < 64) v &= (1ull << bits) - 1;
+            break;
+        }
+        default: {
+            while(*s == ' ') ++s;
+            if(*s == '-') return 0;
+            unsigned long long x = strtoull(s, &end, (type == 'x') ? 16 : 0);
+            if(bits < 64 && (x >> bits)) return 0;
+            v = x;
+            break;
+        }
+    }
+    if(end == s || errno == ERANGE) return 0;
+    while(*end == ' ') ++end;
+    if(*end) return 0;
+    to_keys(&v, 1, width, type);
+    *pkey = v;
+    return 1;
+}
+
+// loads n fields, stride bytes apart; the cases let the compiler turn
+// the byte shuffling into plain loads and byte swaps
+static void gather(const unsigned char* p, size_t stride, size_t n,
+        int width, int be, uint64_t* v)
+{
+    switch(2 * width + !!be) {
+        case 2: case 3: for(size_t i = 0; i < n; ++i) v[i] = p[i * stride]; break;
+        case 4: for(size_t i = 0; i < n; ++i) v[i] = load(p + i * stride, 2, 0); break;
+        case 5: for(size_t i = 0; i < n; ++i) v[i] = load(p + i * stride, 2, 1); break;
+        case 8: for(size_t i = 0; i < n; ++i) v[i] = load(p + i * stride, 4, 0); break;
+        case 9: for(size_t i = 0; i < n; ++i) v[i] = load(p + i * stride, 4, 1); break;
+        case 16: for(size_t i = 0; i < n; ++i) v[i] = load(p + i * stride, 8, 0); break;
+        case 17: for(size_t i = 0; i < n; ++i) v[i] = load(p + i * stride, 8, 1); break;
+        default: for(size_t i = 0; i < n; ++i) v[i] = load(p + i * stride, width, be); break;
+    }
+}
+
+static uint64_t mix(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+    return k;
+}
+
+// adds a key to the hash set; returns 0 if it's full
+static int small_add(uint64_t* set, size_t* pn, uint64_t k)
+{
+    // keys are stored plus one, so zero is free; all ones would wrap
+    // around, so it gets the slot past the table
+    size_t i = SLOTS;
+    if(k != UINT64_MAX) {
+        i = mix(k) & (SLOTS - 1);
+        while(set[i]) {
+            if(set[i] == k + 1) return 1;
+            i = (i + 1) & (SLOTS - 1);
+        }
+    } else if(set[i]) {
+        return 1;
+    }
+    if(*pn >= SMALL) return 0;
+    set[i] = (i == SLOTS) ? 1 : k + 1;
+    ++*pn;
+    return 1;
+}
+
+// the key in slot j of a hash set, which mustn't be free
+static uint64_t small_key(const uint64_t* set, size_t j)
+{
+    return (j == SLOTS) ? UINT64_MAX : set[j] - 1;
+}
+
+static void hll_add(unsigned char* hll, uint64_t k)
+{
+    uint64_t h = mix(k);
+    size_t j = (size_t)(h >> (64 - HLLBITS));
+    uint64_t rest = (h << HLLBITS) | (1ull << (HLLBITS - 1));
+    unsigned char rank = 1;
+    while(!(rest & TOP)) {
+        rest <<= 1;
+        ++rank;
+    }
+    if(rank > hll[j]) hll[j] = rank;
+}
+
+// a HyperLogLog of the keys in a hash set
+static unsigned char* hll_from(const uint64_t* set)
+{
+    unsigned char* hll = calloc(1u << HLLBITS, 1);
+    if(!hll) return NULL;
+    for(size_t j = 0; j <= SLOTS; ++j) {
+        if(set[j]) hll_add(hll, small_key(set, j));
+    }
+    return hll;
+}
+
+static size_t hll_estimate(const unsigned char* hll)
+{
+    const double m = (double)(1u << HLLBITS);
+    double sum = 0;
+    size_t zeros = 0;
+    for(size_t j = 0; j < (1u << HLLBITS); ++j) {
+        sum += ldexp(1.0, -hll[j]);
+        zeros += !hll[j];
+    }
+    double e = (0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+    if(e <= 2.5 * m && zeros) e = m * log(m / (double)zeros);
+    return (size_t)(e + 0.5);
+}
+
+static void stats_job(size_t i, void* ctx)
+{
+    struct stats* st = ctx;
+    struct part* pt = &st->parts[i];
+    uint64_t v[BLOCK];
+    double d[BLOCK];
+
+    pt->min = UINT64_MAX;
+    pt->max = 0;
+    if(st->width <= 2) {
+        pt->bits = calloc((st->width == 1) ? 4 : 1024, 8);
+        if(!pt->bits) { pt->nomem = 1; return; }
+    } else {
+        pt->small = calloc(SLOTS + 1, 8);
+        if(!pt->small) { pt->nomem = 1; return; }
+    }
+
+    for(size_t r = 0; r < pt->n; r += BLOCK) {
+        size_t n = (pt->n - r < BLOCK) ? pt->n - r : BLOCK;
+        gather(st->p + (pt->from + r) * st->size, st->size, n,
+                st->width, st->be, v);
+        to_keys(v, n, st->width, st->type);
+
+        // the values, for the sum; NaNs don't count for anything
+        switch(st->type) {
+            case 's':
+                for(size_t k = 0; k < n; ++k) d[k] = (double)(int64_t)(v[k] ^ TOP);
+                break;
+            case 'f': {
+                size_t m = 0;
+                for(size_t k = 0; k < n; ++k) {
+                    double x = bits_to_double(record_value(v[k], 'f'));
+                    if(x != x) continue;
+                    v[m] = v[k];
+                    d[m++] = x;
+                }
+                n = m;
+                break;
+            }
+            default:
+                for(size_t k = 0; k < n; ++k) d[k] = (double)v[k];
+                break;
+        }
+
+        uint64_t lo = pt->min, hi = pt->max;
+        double sum = 0;
+        for(size_t k = 0; k < n; ++k) {
+            lo = (v[k] < lo) ? v[k] : lo;
+            hi = (v[k] > hi) ? v[k] : hi;
+            sum += d[k];
+        }
+        pt->min = lo;
+        pt->max = hi;
+        pt->sum += sum;
+        pt->count += n;
+
+        if(pt->bits) {
+            // the low bits of a key are the field itself
+            uint64_t mask = (st->width == 1) ? 0xFF : 0xFFFF;
+            for(size_t k = 0; k < n; ++k) {
+                uint64_t b = v[k] & mask;
+                pt->bits[b >> 6] |= 1ull << (b & 63);
+            }
+        } else {
+            size_t k = 0;
+            for(; k < n && !pt->hll; ++k) {
+                if(small_add(pt->small, &pt->nsmall, v[k])) continue;
+                pt->hll = hll_from(pt->small);
+                if(!pt->hll) { pt->nomem = 1; return; }
+                hll_add(pt->hll, v[k]);
+            }
+            if(pt->hll) {
+                for(; k < n; ++k) hll_add(pt->hll, v[k]);
+            }
+        }
+    }
+}
+
+/** records_stats
+  *
+  * Works out statistics of a field over nrec records of size bytes,
+  * starting at p. The field is width bytes at offset into every record,
+  * typed as for record_key(). NaNs are left out.
+  *
+  * Sets *pcount to the number of values, *pmin and *pmax to the keys of
+  * the smallest and largest of them, *psum to their sum and *pdistinct to
+  * how many different ones there are. Returns 1 if that count is exact,
+  * 2 if it's an estimate, and 0 if we ran out of memory.
+  */
+int
+records_stats(const unsigned char* p, size_t nrec, size_t size,
+        size_t offset, int width, int be, char type,
+        size_t* pcount, uint64_t* pmin, uint64_t* pmax, double* psum,
+        size_t* pdistinct)
+{
+    size_t per = (nrec + MAXJOBS - 1) / MAXJOBS;
+    if(per < MINJOB) per = MINJOB;
+    size_t njobs = (nrec + per - 1) / per;
+
+    struct stats st = { p + offset, size, width, be, type, NULL };
+    st.parts = calloc(njobs ? njobs : 1, sizeof(struct part));
+    if(!st.parts) return 0;
+    for(size_t i = 0; i < njobs; ++i) {
+        st.parts[i].from = i * per;
+        st.parts[i].n = (nrec - i * per < per) ? nrec - i * per : per;
+    }
+    if(njobs > 1) run_parallel(njobs, stats_job, &st);
+    else if(njobs) stats_job(0, &st);
+
+    int ret = 1;
+    size_t count = 0;
+    uint64_t lo = UINT64_MAX, hi = 0;
+    double sum = 0;
+    uint64_t* bits = NULL;
+    uint64_t* small = NULL;
+    size_t nsmall = 0;
+    unsigned char* hll = NULL;
+    if(width <= 2) bits = calloc(1024, 8);
+    else small = calloc(SLOTS + 1, 8);
+    if(!bits && !small) ret = 0;
+
+    for(size_t i = 0; i < njobs && ret; ++i) {
+        struct part* pt = &st.parts[i];
+        if(pt->nomem) { ret = 0; break; }
+        count += pt->count;
+        if(pt->count) {
+            if(pt->min < lo) lo = pt->min;
+            if(pt->max > hi) hi = pt->max;
+        }
+        sum += pt->sum;
+        if(bits) {
+            for(size_t j = 0; j < ((width == 1) ? 4 : 1024); ++j) bits[j] |= pt->bits[j];
+            continue;
+        }
+        // everything goes into one estimate as soon as anything overflows
+        if(!hll && pt->hll) {
+            hll = hll_from(small);
+            if(!hll) { ret = 0; break; }
+        }
+        for(size_t j = 0; j <= SLOTS; ++j) {
+            if(!pt->small[j]) continue;
+            uint64_t k = small_key(pt->small, j);
+            if(hll) {
+                hll_add(hll, k);
+            } else if(!small_add(small, &nsmall, k)) {
+                hll = hll_from(small);
+                if(!hll) { ret = 0; break; }
+                hll_add(hll, k);
+            }
+        }
+        if(hll && pt->hll) {
+            for(size_t j = 0; j < (1u << HLLBITS); ++j) {
+                if(pt->hll[j] > hll[j]) hll[j] = pt->hll[j];
+            }
+        }
+    }
+
+    if(ret) {
+        size_t distinct = nsmall;
+        if(bits) {
+            distinct = 0;
+            for(size_t j = 0; j < 1024; ++j) {
+                for(uint64_t b = bits[j]; b; b &= b - 1) ++distinct;
+            }
+        } else if(hll) {
+            distinct = hll_estimate(hll);
+            ret = 2;
+        }
+        *pcount = count;
+        *pmin = lo;
+        *pmax = hi;
+        *psum = sum;
+        *pdistinct = distinct;
+    }
+
+    for(size_t i = 0; i < njobs; ++i) {
+        free(st.parts[i].bits);
+        free(st.parts[i].small);
+        free(st.parts[i].hll);
+    }
+    free(st.parts);
+    free(bits);
+    free(small);
+    free(hll);
+    return ret;
+}
+
+struct pair {
+    uint64_t key;
+    size_t i;
+};
+
+struct sorter {
+    unsigned char* p;
+    size_t nrec, size, offset;
+    int width, be;
+    char type;
+    struct pair* a;
+    struct pair* b;         // as much scratch space
+    size_t per;             // pairs sorted by every job of the first phase
+    size_t run;             // how long the sorted runs are in a merge round
+    unsigned char* out;     // the records in their new order
+    size_t nout;
+};
+
+// a key which orders like the field, in just as many bytes
+static void to_sort_keys(uint64_t* v, size_t n, int width, char type)
+{
+    uint64_t sign = 1ull << (8 * width - 1);
+    uint64_t all = sign | (sign - 1);
+    switch(type) {
+        case 's':
+            for(size_t i = 0; i < n; ++i) v[i] ^= sign;
+            break;
+        case 'f':
+            for(size_t i = 0; i < n; ++i) v[i] = (v[i] & sign) ? ~v[i] & all : v[i] | sign;
+            break;
+    }
+}
+
+static void radix_job(size_t j, void* ctx)
+{
+    struct sorter* st = ctx;
+    size_t from = j * st->per;
+    size_t n = (st->nrec - from < st->per) ? st->nrec - from : st->per;
+    struct pair* a = st->a + from;
+    struct pair* b = st->b + from;
+    uint64_t v[BLOCK];
+
+    for(size_t r = 0; r < n; r += BLOCK) {
+        size_t m = (n - r < BLOCK) ? n - r : BLOCK;
+        gather(st->p + (from + r) * st->size + st->offset, st->size, m,
+                st->width, st->be, v);
+        to_sort_keys(v, m, st->width, st->type);
+        for(size_t k = 0; k < m; ++k) {
+            a[r + k].key = v[k];
+            a[r + k].i = from + r + k;
+        }
+    }
+
+    for(int byte = 0; byte < st->width; ++byte) {
+        size_t count[256] = { 0 };
+        int sh = 8 * byte;
+        for(size_t k = 0; k < n; ++k) count[(a[k].key >> sh) & 0xFF]++;
+        if(n == 0 || count[(a[0].key >> sh) & 0xFF] == n) continue;
+        size_t at = 0;
+        for(int c = 0; c < 256; ++c) {
+            size_t t = count[c];
+            count[c] = at;
+            at += t;
+        }
+        for(size_t k = 0; k < n; ++k) b[count[(a[k].key >> sh) & 0xFF]++] = a[k];
+        struct pair* t = a;
+        a = b;
+        b = t;
+    }
+    if(a != st->a + from) memcpy(st->a + from, a, n * sizeof(struct pair));
+}
+
+static void merge_job(size_t j, void* ctx)
+{
+    struct sorter* st = ctx;
+    size_t lo = j * 2 * st->run;
+    size_t mid = (st->nrec - lo < st->run) ? st->nrec : lo + st->run;
+    size_t hi = (st->nrec - mid < st->run) ? st->nrec : mid + st->run;
+    const struct pair* a = st->a;
+    struct pair* out = st->b;
+    size_t x = lo, y = mid, k = lo;
+    // ties go to the left, which keeps it stable
+    while(x < mid && y < hi) out[k++] = (a[y].key < a[x].key) ? a[y++] : a[x++];
+    while(x < mid) out[k++] = a[x++];
+    while(y < hi) out[k++] = a[y++];
+}
+
+static void copy_job(size_t j, void* ctx)
+{
+    struct sorter* st = ctx;
+    size_t from = j * st->per;
+    size_t n = (st->nout - from < st->per) ? st->nout - from : st->per;
+    for(size_t k = from; k < from + n; ++k) {
+        memcpy(st->out + k * st->size, st->p + st->a[k].i * st->size, st->size);
+    }
+}
+
+// orders records with the same key by their bytes, then where they were
+static const unsigned char* cmpBase;
+static size_t cmpSize;
+static int cmp_records(const void* va, const void* vb)
+{
+    const struct pair* a = va;
+    const struct pair* b = vb;
+    int c = memcmp(cmpBase + a->i * cmpSize, cmpBase + b->i * cmpSize, cmpSize);
+    if(c) return c;
+    return (a->i < b->i) ? -1 : (a->i > b->i);
+}
+
+/** records_sort
+  *
+  * Sorts nrec records of size bytes at p by a field, typed as for
+  * records_stats(). Records with equal fields stay in the order they were
+  * in. dups says what to do with duplicates:
+  *     a   keep them all
+  *     k   keep only the first record with any key
+  *     r   keep only the first of identical records; records with the
+  *         same key get ordered by their bytes
+  * Returns the number of records kept, which go at the start of p, or
+  * SIZE_MAX if we ran out of memory, in which case nothing was done.
+  */
+size_t
+records_sort(unsigned char* p, size_t nrec, size_t size,
+        size_t offset, int width, int be, char type, char dups)
+{
+    if(nrec == 0) return 0;
+    struct sorter st = { p, nrec, size, offset, width, be, type,
+        NULL, NULL, 0, 0, NULL, 0 };
+    st.a = malloc(nrec * sizeof(struct pair));
+    st.b = malloc(nrec * sizeof(struct pair));
+    if(!st.a || !st.b) goto nomem;
+
+    st.per = (nrec + MAXJOBS - 1) / MAXJOBS;
+    if(st.per < MINJOB) st.per = MINJOB;
+    size_t njobs = (nrec + st.per - 1) / st.per;
+    if(njobs > 1) run_parallel(njobs, radix_job, &st);
+    else radix_job(0, &st);
+
+    for(st.run = st.per; st.run < nrec; st.run *= 2) {
+        size_t n = (nrec + 2 * st.run - 1) / (2 * st.run);
+        if(n > 1) run_parallel(n, merge_job, &st);
+        else merge_job(0, &st);
+        struct pair* t = st.a;
+        st.a = st.b;
+        st.b = t;
+    }
+    free(st.b);
+    st.b = NULL;
+
+    st.nout = nrec;
+    if(dups == 'k' || dups == 'r') {
+        size_t kept = 0;
+        for(size_t i = 0; i < nrec;) {
+            size_t j = i + 1;
+            while(j < nrec && st.a[j].key == st.a[i].key) ++j;
+            if(dups == 'k') {
+                st.a[kept++] = st.a[i];
+            } else {
+                cmpBase = p;
+                cmpSize = size;
+                if(j - i > 1) qsort(st.a + i, j - i, sizeof(struct pair), cmp_records);
+                st.a[kept++] = st.a[i];
+                for(size_t k = i + 1; k < j; ++k) {
+                    if(memcmp(p + st.a[k].i * size, p + st.a[kept - 1].i * size, size)) {
+                        st.a[kept++] = st.a[k];
+                    }
+                }
+            }
+            i = j;
+        }
+        st.nout = kept;
+    }
+
+    st.out = malloc(st.nout * size);
+    if(!st.out) goto nomem;
+    njobs = (st.nout + st.per - 1) / st.per;
+    if(njobs > 1) run_parallel(njobs, copy_job, &st);
+    else copy_job(0, &st);
+    memcpy(p, st.out, st.nout * size);
+
+    free(st.out);
+    free(st.a);
+    return st.nout;
+
+nomem:
+    free(st.a);
+    free(st.b);
+    return SIZE_MAX;
+}
+
+// how far apart two keys are, as numbers
+static double distance(uint64_t a, uint64_t b, char type)
+{
+    if(type == 'f') {
+        return fabs(bits_to_double(record_value(a, 'f'))
+                - bits_to_double(record_value(b, 'f')));
+    }
+    return (double)((a > b) ? a - b : b - a);
+}
+
+/** records_bisect
+  *
+  * Looks for the record whose field is key, among nrec records of size
+  * bytes at p sorted by that field, either way round; the field is typed
+  * as for records_stats(). Only looks at about log2(nrec) of them.
+  *
+  * Returns the number of the first record which matches, or failing that
+  * the one whose field is nearest to key, and sets *pexact to whether it
+  * matched and *pprobes to how many records were looked at.
+  */
+size_t
+records_bisect(const unsigned char* p, size_t nrec, size_t size,
+        size_t offset, int width, int be, char type, uint64_t key,
+        int* pexact, int* pprobes)
+{
+    *pexact = 0;
+    *pprobes = 0;
+    if(nrec == 0) return 0;
+    p += offset;
+    uint64_t first = record_key(p, width, be, type);
+    uint64_t last = record_key(p + (nrec - 1) * size, width, be, type);
+    int probes = 2;
+    int down = first > last;
+
+    // the first record which doesn't come before key
+    size_t lo = 0, hi = nrec;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        uint64_t k = record_key(p + mid * size, width, be, type);
+        ++probes;
+        if(down ? k > key : k < key) lo = mid + 1;
+        else hi = mid;
+    }
+
+    size_t found = lo;
+    if(lo < nrec && record_key(p + lo * size, width, be, type) == key) {
+        *pexact = 1;
+    } else if(lo == nrec) {
+        found = nrec - 1;
+    } else if(lo > 0) {
+        uint64_t before = record_key(p + (lo - 1) * size, width, be, type);
+        uint64_t after = record_key(p + lo * size, width, be, type);
+        ++probes;
+        if(distance(before, key, type) <= distance(after, key, type)) found = lo - 1;
+    }
+    *pprobes = probes;
+    return found;
+}
@@ -0,0 +1,211 @@
+/*
+Copyright 2024 Vlad Mesco
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+// Run skipping and comparing. Padding in dumps comes in runs of megabytes
+// or gigabytes of the same byte; these look at 64 bytes per iteration so
+// jumping past a 1GiB run costs about as much as reading it once.
+// Comparing two buffers for the diff mode works the same way.
+//
+// The fast path uses SSE2 where the compiler says it's there (every
+// x86-64), and otherwise compares 8 bytes at a time in 64 bit words.
+
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+static size_t first_diff_slow(const unsigned char* p, size_t n, unsigned char b)
+{
+    size_t i = 0;
+    while(i < n && p[i] == b) ++i;
+    return i;
+}
+
+static size_t last_diff_slow(const unsigned char* p, size_t n, unsigned char b)
+{
+    size_t i = 0;
+    while(i < n && p[n - 1 - i] == b) ++i;
+    return i;
+}
+
+/** scan_skip
+  *
+  * Returns the index of the first byte in p[n] which is not b, or n if
+  * they're all b.
+  */
+size_t
+scan_skip(const unsigned char* p, size_t n, unsigned char b)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128i bb = _mm_set1_epi8((char)b);
+    for(; i + 64 <= n; i += 64) {
+        __m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + i)), bb);
+        __m128i e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + i + 16)), bb);
+        __m128i e2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + i + 32)), bb);
+        __m128i e3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + i + 48)), bb);
+        __m128i all = _mm_and_si128(_mm_and_si128(e0, e1), _mm_and_si128(e2, e3));
+        if(_mm_movemask_epi8(all) != 0xFFFF) break;
+    }
+#else
+    uint64_t bb = 0x0101010101010101ull * b;
+    for(; i + 64 <= n; i += 64) {
+        uint64_t w[8];
+        memcpy(w, p + i, sizeof(w));
+        uint64_t d = (w[0] ^ bb) | (w[1] ^ bb) | (w[2] ^ bb) | (w[3] ^ bb)
+                   | (w[4] ^ bb) | (w[5] ^ bb) | (w[6] ^ bb) | (w[7] ^ bb);
+        if(d) break;
+    }
+#endif
+    // the block with the difference, and the tail
+    return i + first_diff_slow(p + i, n - i, b);
+}
+
+/** scan_rskip
+  *
+  * Returns how many bytes at the end of p[n] are b. The last byte which
+  * isn't b, if there is one, is p[n - 1 - scan_rskip(p, n, b)].
+  */
+size_t
+scan_rskip(const unsigned char* p, size_t n, unsigned char b)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128i bb = _mm_set1_epi8((char)b);
+    for(; i + 64 <= n; i += 64) {
+        const unsigned char* q = p + n - i - 64;
+        __m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(q)), bb);
+        __m128i e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(q + 16)), bb);
+        __m128i e2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(q + 32)), bb);
+        __m128i e3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(q + 48)), bb);
+        __m128i all = _mm_and_si128(_mm_and_si128(e0, e1), _mm_and_si128(e2, e3));
+        if(_mm_movemask_epi8(all) != 0xFFFF) break;
+    }
+#else
+    uint64_t bb = 0x0101010101010101ull * b;
+    for(; i + 64 <= n; i += 64) {
+        uint64_t w[8];
+        memcpy(w, p + n - i - 64, sizeof(w));
+        uint64_t d = (w[0] ^ bb) | (w[1] ^ bb) | (w[2] ^ bb) | (w[3] ^ bb)
+                   | (w[4] ^ bb) | (w[5] ^ bb) | (w[6] ^ bb) | (w[7] ^ bb);
+        if(d) break;
+    }
+#endif
+    return i + last_diff_slow(p, n - i, b);
+}
+
+/** scan_runs
+  *
+  * Calls cb(offset, length, byte, ctx) for every run of at least minlen
+  * identical bytes in p[n], in order. Stops early if cb returns 0.
+  *
+  * A run of minlen bytes must cover two probes h = minlen/2 apart where
+  * the first probe is a multiple of h, so only every h-th byte gets looked
+  * at outside of runs.
+  */
+void
+scan_runs(const unsigned char* p, size_t n, size_t minlen,
+        int (*cb)(size_t, size_t, unsigned char, void*), void* ctx)
+{
+    if(minlen < 2) minlen = 2;
+    size_t h = minlen / 2;
+    size_t j = 0;
+    while(j + h < n) {
+        if(p[j] != p[j + h]) {
+            j += h;
+            continue;
+        }
+        unsigned char b = p[j];
+        size_t start = j - scan_rskip(p, j, b);
+        size_t end = j + scan_skip(p + j, n - j, b);
+        if(end - start >= minlen && !cb(start, end - start, b, ctx)) return;
+        // next probe is the first multiple of h past this run
+        size_t next = (end + h - 1) / h * h;
+        j = (next > j + h) ? next : j + h;
+    }
+}
+
+/** scan_cmp
+  *
+  * Returns the index of the first byte where a[n] and b[n] differ, or n
+  * if they're the same.
+  */
+size_t
+scan_cmp(const unsigned char* a, const unsigned char* b, size_t n)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for(; i + 64 <= n; i += 64) {
+        __m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)),
+                                    _mm_loadu_si128((const __m128i*)(b + i)));
+        __m128i e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i + 16)),
+                                    _mm_loadu_si128((const __m128i*)(b + i + 16)));
+        __m128i e2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i + 32)),
+                                    _mm_loadu_si128((const __m128i*)(b + i + 32)));
+        __m128i e3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i + 48)),
+                                    _mm_loadu_si128((const __m128i*)(b + i + 48)));
+        __m128i all = _mm_and_si128(_mm_and_si128(e0, e1), _mm_and_si128(e2, e3));
+        if(_mm_movemask_epi8(all) != 0xFFFF) break;
+    }
+#else
+    for(; i + 64 <= n; i += 64) {
+        uint64_t x[8], y[8];
+        memcpy(x, a + i, sizeof(x));
+        memcpy(y, b + i, sizeof(y));
+        uint64_t d = (x[0] ^ y[0]) | (x[1] ^ y[1]) | (x[2] ^ y[2]) | (x[3] ^ y[3])
+                   | (x[4] ^ y[4]) | (x[5] ^ y[5]) | (x[6] ^ y[6]) | (x[7] ^ y[7]);
+        if(d) break;
+    }
+#endif
+    while(i < n && a[i] == b[i]) ++i;
+    return i;
+}
+
+/** scan_rcmp
+  *
+  * Returns how many bytes at the end of a[n] and b[n] are the same. The
+  * last difference, if there is one, is at n - 1 - scan_rcmp(a, b, n).
+  */
+size_t
+scan_rcmp(const unsigned char* a, const unsigned char* b, size_t n)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for(; i + 64 <= n; i += 64) {
+        const unsigned char* x = a + n - i - 64;
+        const unsigned char* y = b + n - i - 64;
+        __m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(x)),
+                                    _mm_loadu_si128((const __m128i*)(y)));
+        __m128i e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(x + 16)),
+                                    _mm_loadu_si128((const __m128i*)(y + 16)));
+        __m128i e2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(x + 32)),
+                                    _mm_loadu_si128((const __m128i*)(y + 32)));
+        __m128i e3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(x + 48)),
+                                    _mm_loadu_si128((const __m128i*)(y + 48)));
+        __m128i all = _mm_and_si128(_mm_and_si128(e0, e1), _mm_and_si128(e2, e3));
+        if(_mm_movemask_epi8(all) != 0xFFFF) break;
+    }
+#else
+    for(; i + 64 <= n; i += 64) {
+        uint64_t x[8], y[8];
+        memcpy(x, a + n - i - 64, sizeof(x));
+        memcpy(y, b + n - i - 64, sizeof(y));
+        uint64_t d = (x[0] ^ y[0]) | (x[1] ^ y[1]) | (x[2] ^ y[2]) | (x[3] ^ y[3])
+                   | (x[4] ^ y[4]) | (x[5] ^ y[5]) | (x[6] ^ y[6]) | (x[7] ^ y[7]);
+        if(d) break;
+    }
+#endif
+    while(i < n && a[n - 1 - i] == b[n - 1 - i]) ++i;
+    return i;
+}
@@ -0,0 +1,175 @@
+/*
+Copyright 2024 Vlad Mesco
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+// Latency bookkeeping for the instrumentation overlay and --stats.
+//
+// Samples go into numbered slots (jakhex uses key codes for commands and
+// a few extra numbers for redraws, I/O and such). Each slot keeps a
+// histogram with 4 buckets per power of two, which is plenty to tell a
+// p99 of 2ms from one of 3ms, and doesn't grow with the number of samples.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define STATS_SLOTS 1024
+#define STATS_BUCKETS 252
+
+struct slot {
+    unsigned long count;
+    unsigned long last;
+    unsigned long max;
+    double total;
+    unsigned long buckets[STATS_BUCKETS];
+};
+
+// allocated on first use, so unused slots cost a pointer
+static struct slot* slots[STATS_SLOTS];
+
+static int bucket_of(unsigned long v)
+{
+    if(v < 4) return (int)v;
+    int b = 63;
+    while(!(v >> b)) --b;
+    return 4 * (b - 1) + (int)((v >> (b - 2)) & 3);
+}
+
+static unsigned long bucket_top(int i)
+{
+    if(i < 4) return (unsigned long)i;
+    int b = i / 4 + 1;
+    unsigned long low = (unsigned long)(4 + i % 4) << (b - 2);
+    return low + ((1ul << (b - 2)) - 1);
+}
+
+/** stats_record
+  *
+  * Adds a sample of ns nanoseconds to slot.
+  */
+void
+stats_record(int slot, unsigned long ns)
+{
+    if(slot < 0 || slot >= STATS_SLOTS) return;
+    struct slot* s = slots[slot];
+    if(!s) {
+        s = slots[slot] = calloc(1, sizeof(struct slot));
+        // we can live without statistics
+        if(!s) return;
+    }
+    s->count++;
+    s->last = ns;
+    if(ns > s->max) s->max = ns;
+    s->total += (double)ns;
+    s->buckets[bucket_of(ns)]++;
+}
+
+/** stats_count
+  *
+  * Returns the number of samples in slot.
+  */
+unsigned long
+stats_count(int slot)
+{
+    if(slot < 0 || slot >= STATS_SLOTS || !slots[slot]) return 0;
+    return slots[slot]->count;
+}
+
+/** stats_last
+  *
+  * Returns the latest sample in slot, or 0.
+  */
+unsigned long
+stats_last(int slot)
+{
+    if(slot < 0 || slot >= STATS_SLOTS || !slots[slot]) return 0;
+    return slots[slot]->last;
+}
+
+/** stats_percentile
+  *
+  * Returns (roughly, i.e. to within a quarter of a power of two) the
+  * value below which pct percent of the samples in slot fall.
+  */
+unsigned long
+stats_percentile(int slot, double pct)
+{
+    if(slot < 0 || slot >= STATS_SLOTS || !slots[slot]) return 0;
+    struct slot* s = slots[slot];
+    double rank = pct / 100.0 * (double)s->count;
+    unsigned long seen = 0;
+    for(int i = 0; i < STATS_BUCKETS; ++i) {
+        seen += s->buckets[i];
+        if(seen > 0 && (double)seen >= rank) {
+            unsigned long top = bucket_top(i);
+            return top < s->max ? top : s->max;
+        }
+    }
+    return s->max;
+}
+
+/** stats_format
+  *
+  * Prints a duration in nanoseconds in a human friendly unit into
+  * buf[nbuf]. Returns buf.
+  */
+char*
+stats_format(unsigned long ns, char* buf, size_t nbuf)
+{
+    if(ns < 1000ul) snprintf(buf, nbuf, "%luns", ns);
+    else if(ns < 1000000ul) snprintf(buf, nbuf, "%.1fus", (double)ns / 1e3);
+    else if(ns < 1000000000ul) snprintf(buf, nbuf, "%.2fms", (double)ns / 1e6);
+    else snprintf(buf, nbuf, "%.2fs", (double)ns / 1e9);
+    return buf;
+}
+
+/** stats_dump
+  *
+  * Prints a summary and a histogram (one row per power of two) of
+  * every slot with samples in it to f. name(slot) tells what a slot is.
+  */
+void
+stats_dump(FILE* f, const char* (*name)(int))
+{
+    char b1[16], b2[16], b3[16], b4[16], b5[16];
+    for(int slot = 0; slot < STATS_SLOTS; ++slot) {
+        struct slot* s = slots[slot];
+        if(!s || !s->count) continue;
+
+        fprintf(f, "%-16s n=%-8lu mean %-9s p50 %-9s p99 %-9s max %s\n",
+                name(slot), s->count,
+                stats_format((unsigned long)(s->total / (double)s->count), b1, sizeof(b1)),
+                stats_format(stats_percentile(slot, 50.0), b2, sizeof(b2)),
+                stats_format(stats_percentile(slot, 99.0), b3, sizeof(b3)),
+                stats_format(s->max, b4, sizeof(b4)));
+
+        unsigned long most = 0;
+        unsigned long rows[64];
+        memset(rows, 0, sizeof(rows));
+        for(int i = 0; i < STATS_BUCKETS; ++i) {
+            // power of two the bucket falls under; 0 and 1 share a row
+            int b = (i < 2) ? 0 : (i < 4) ? 1 : i / 4 + 1;
+            rows[b] += s->buckets[i];
+            if(rows[b] > most) most = rows[b];
+        }
+        for(int b = 0; b < 64; ++b) {
+            if(!rows[b]) continue;
+            int bar = (int)((rows[b] * 40 + most - 1) / most);
+            fprintf(f, "    %9s - %-9s %8lu |",
+                    stats_format(b ? 1ul << b : 0, b1, sizeof(b1)),
+                    stats_format((2ul << b) - 1, b5, sizeof(b5)),
+                    rows[b]);
+            for(int i = 0; i < bar; ++i) fputc('#', f);
+            fputc('\n', f);
+        }
+    }
+}
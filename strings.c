@@ -0,0 +1,317 @@
+/*
+Copyright 2024 Vlad Mesco
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+// What strings(1) does: find runs of at least minlen printable ASCII
+// characters, and of printable ASCII characters encoded as UTF-16LE (i.e.
+// followed by a zero byte). Printable is 0x20-0x7E and TAB.
+//
+// Bytes are classified 64 at a time into bit masks, with SSE2 if the
+// compiler has it, and runs are read off the masks with count-trailing-
+// zeros, so stretches of binary without any strings go by a block at a
+// time. The buffer is cut into 4MiB chunks which are searched in
+// parallel; each chunk owns the strings which start in it, and follows
+// them past its end if need be.
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+extern void
+run_parallel(size_t, void (*)(size_t, void*), void*);
+
+#define CHUNK (4u << 20)    // must be a multiple of 64
+#define NONE SIZE_MAX
+#define EVEN 0x5555555555555555ull
+#define ODD  0xAAAAAAAAAAAAAAAAull
+
+struct string {
+    size_t offset;
+    size_t length;  // in bytes
+    int wide;
+};
+
+struct strvec {
+    struct string* v;
+    size_t n, cap;
+};
+
+struct strings {
+    struct string* v;
+    size_t n;
+};
+
+// a run of set bits being followed through the masks
+struct run {
+    size_t start;       // NONE if not in a run
+    int inherited;      // started in the previous chunk, not ours
+};
+
+struct find_job {
+    const unsigned char* p;
+    size_t n;
+    size_t minlen;
+    struct strvec* out;     // one per chunk
+    int failed;
+};
+
+static int ctz64(uint64_t x)
+{
+#ifdef __GNUC__
+    return __builtin_ctzll(x);
+#else
+    int n = 0;
+    while(!(x & 1)) {
+        x >>= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
+
+static int printable(unsigned char c)
+{
+    return (c >= 0x20 && c < 0x7F) || c == '\t';
+}
+
+// bit i of *P is set if p[i] is printable, of *Z if p[i] is zero
+static void classify(const unsigned char* p, size_t nbytes, uint64_t* P, uint64_t* Z)
+{
+#ifdef __SSE2__
+    if(nbytes == 64) {
+        const __m128i lo = _mm_set1_epi8(0x1F);
+        const __m128i hi = _mm_set1_epi8(0x7F);
+        const __m128i tab = _mm_set1_epi8('\t');
+        const __m128i zero = _mm_setzero_si128();
+        uint64_t pm = 0, zm = 0;
+        for(int k = 0; k < 4; ++k) {
+            __m128i b = _mm_loadu_si128((const __m128i*)(p + 16 * k));
+            // signed compares, so 0x80-0xFF are below 0x1F
+            __m128i pr = _mm_or_si128(
+                    _mm_and_si128(_mm_cmpgt_epi8(b, lo), _mm_cmplt_epi8(b, hi)),
+                    _mm_cmpeq_epi8(b, tab));
+            pm |= (uint64_t)(unsigned)_mm_movemask_epi8(pr) << (16 * k);
+            zm |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(b, zero)) << (16 * k);
+        }
+        *P = pm;
+        *Z = zm;
+        return;
+    }
+#endif
+    uint64_t pm = 0, zm = 0;
+    for(size_t i = 0; i < nbytes; ++i) {
+        pm |= (uint64_t)printable(p[i]) << i;
+        zm |= (uint64_t)(p[i] == 0) << i;
+    }
+    *P = pm;
+    *Z = zm;
+}
+
+static int push(struct strvec* out, size_t offset, size_t length, int wide)
+{
+    if(out->n >= out->cap) {
+        size_t cap = out->cap ? out->cap * 2 : 256;
+        void* v = realloc(out->v, cap * sizeof(struct string));
+        if(!v) return 0;
+        out->v = v;
+        out->cap = cap;
+    }
+    out->v[out->n].offset = offset;
+    out->v[out->n].length = length;
+    out->v[out->n].wide = wide;
+    out->n++;
+    return 1;
+}
+
+// the run r ended at byte `end'. For UTF-16 runs, every other bit is
+// filler and the last character starts at the last bit of our parity
+static void end_run(struct find_job* j, struct strvec* out, struct run* r,
+        size_t end, int wide, size_t cs, size_t ce)
+{
+    size_t start = r->start;
+    int inherited = r->inherited;
+    r->start = NONE;
+    r->inherited = 0;
+    if(inherited || start < cs || start >= ce) return;
+
+    size_t length = end - start, nchars = length;
+    if(wide) {
+        size_t last = ((end - 1 - start) & 1) ? end - 2 : end - 1;
+        length = last + 2 - start;
+        nchars = length / 2;
+    }
+    if(nchars < j->minlen) return;
+    if(!push(out, start, length, wide)) j->failed = 1;
+}
+
+// follow runs of set bits in m through bits [0, nbits) of the block at
+// base; a run may only start on a bit set in starts
+static void track(struct find_job* j, struct strvec* out, struct run* r,
+        uint64_t m, uint64_t starts, size_t base, int nbits, int wide,
+        size_t cs, size_t ce)
+{
+    int pos = 0;
+    while(pos < nbits) {
+        if(r->start == NONE) {
+            uint64_t x = (m & starts) >> pos;
+            if(!x) return;
+            pos += ctz64(x);
+            r->start = base + pos;
+        } else {
+            uint64_t x = ~m >> pos;
+            if(!x) return;  // goes on into the next block
+            pos += ctz64(x);
+            end_run(j, out, r, base + pos, wide, cs, ce);
+        }
+    }
+}
+
+static void find_one(size_t job, void* ctx)
+{
+    struct find_job* j = ctx;
+    const unsigned char* p = j->p;
+    size_t n = j->n;
+    size_t cs = (size_t)job * CHUNK;
+    size_t ce = (n - cs > CHUNK) ? cs + CHUNK : n;
+    struct strvec* out = &j->out[job];
+
+    // runs[0] is ASCII; runs[1] and [2] are UTF-16 at even and odd offsets
+    struct run runs[3] = { { NONE, 0 }, { NONE, 0 }, { NONE, 0 } };
+    if(cs > 0) {
+        if(printable(p[cs - 1])) runs[0] = (struct run){ cs - 1, 1 };
+        // cs is even, so the even character before it is at cs - 2
+        if(cs >= 2 && printable(p[cs - 2]) && p[cs - 1] == 0)
+            runs[1] = (struct run){ cs - 2, 1 };
+        if(printable(p[cs - 1]) && p[cs] == 0)
+            runs[2] = (struct run){ cs - 1, 1 };
+    }
+
+    size_t i = cs;
+    while(i < n) {
+        if(i >= ce) {
+            // only strings which started in our chunk are ours
+            int more = 0;
+            for(int k = 0; k < 3; ++k) more |= runs[k].start < ce;
+            if(!more) break;
+        }
+        int nb = (n - i < 64) ? (int)(n - i) : 64;
+        uint64_t P, Z;
+        classify(p + i, nb, &P, &Z);
+        uint64_t valid = (nb == 64) ? ~0ull : ((1ull << nb) - 1);
+        // character c at bit k is a UTF-16 character if byte k + 1 is zero
+        uint64_t zn = Z >> 1;
+        if(nb == 64 && i + 64 < n && p[i + 64] == 0) zn |= 1ull << 63;
+        uint64_t U = P & zn;
+
+        track(j, out, &runs[0], P, ~0ull, i, nb, 0, cs, ce);
+        track(j, out, &runs[1], ((U & EVEN) | ODD) & valid, EVEN, i, nb, 1, cs, ce);
+        track(j, out, &runs[2], ((U & ODD) | EVEN) & valid, ODD, i, nb, 1, cs, ce);
+        i += nb;
+    }
+    for(int k = 0; k < 3; ++k) {
+        if(runs[k].start != NONE) end_run(j, out, &runs[k], i, k > 0, cs, ce);
+    }
+}
+
+static int by_offset(const void* a, const void* b)
+{
+    const struct string* s = a;
+    const struct string* t = b;
+    if(s->offset != t->offset) return (s->offset < t->offset) ? -1 : 1;
+    return s->wide - t->wide;
+}
+
+/** strings_find
+  *
+  * Finds all strings of at least minlen characters in p[n], ordered by
+  * offset. Returns NULL if we ran out of memory. Free the result with
+  * strings_free().
+  */
+void*
+strings_find(const unsigned char* p, size_t n, size_t minlen)
+{
+    struct strings* s = calloc(1, sizeof(struct strings));
+    if(!s) return NULL;
+    if(n == 0) return s;
+
+    size_t njobs = (n + CHUNK - 1) / CHUNK;
+    struct find_job j = { p, n, minlen ? minlen : 1, NULL, 0 };
+    j.out = calloc(njobs, sizeof(struct strvec));
+    if(!j.out) {
+        free(s);
+        return NULL;
+    }
+    run_parallel(njobs, find_one, &j);
+
+    size_t total = 0;
+    for(size_t k = 0; k < njobs; ++k) total += j.out[k].n;
+    if(!j.failed && total) {
+        s->v = malloc(total * sizeof(struct string));
+        if(!s->v) j.failed = 1;
+    }
+    for(size_t k = 0; k < njobs; ++k) {
+        if(!j.failed) {
+            // ASCII and UTF-16 strings come out in the order they end
+            qsort(j.out[k].v, j.out[k].n, sizeof(struct string), by_offset);
+            memcpy(s->v + s->n, j.out[k].v, j.out[k].n * sizeof(struct string));
+            s->n += j.out[k].n;
+        }
+        free(j.out[k].v);
+    }
+    free(j.out);
+    if(j.failed) {
+        free(s->v);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+/** strings_count
+  *
+  * Returns how many strings were found.
+  */
+size_t
+strings_count(void* vs)
+{
+    return ((struct strings*)vs)->n;
+}
+
+/** strings_get
+  *
+  * Returns the offset and length in bytes of string i, and whether it's
+  * UTF-16LE.
+  */
+void
+strings_get(void* vs, size_t i, size_t* offset, size_t* length, int* wide)
+{
+    struct string* s = &((struct strings*)vs)->v[i];
+    *offset = s->offset;
+    *length = s->length;
+    *wide = s->wide;
+}
+
+/** strings_free
+  *
+  * Frees the result of strings_find(). NULL is fine.
+  */
+void
+strings_free(void* vs)
+{
+    struct strings* s = vs;
+    if(!s) return;
+    free(s->v);
+    free(s);
+}
@@ -0,0 +1,259 @@
+/*
+Copyright 2024 Vlad Mesco
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+// Summary pyramid behind the overview screen.
+//
+// Level 0 describes every 4KiB block of the buffer: byte entropy, number
+// of zero bytes and number of printable bytes. Each level above groups 64
+// blocks of the one below, i.e. 256KiB and 16MiB. Zero and printable
+// counts add up exactly; the entropy of a bigger block is the average
+// entropy of its 4KiB blocks, since adding up histograms for a 20GiB file
+// would cost more memory than the file itself.
+//
+// Building it is one pass over the buffer, split across threads. After
+// that, edits only redo the 4KiB blocks they touch and their parents, and
+// showing any part of it at any level costs one lookup per row.
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+extern void
+run_parallel(size_t, void (*)(size_t, void*), void*);
+
+#define LEVELS 3
+#define SHIFT0 12   // 4KiB
+#define FANOUT 6    // 64 children per parent
+
+struct cell {
+    float entropy;  // bits per byte, 0..8
+    uint32_t zeros;
+    uint32_t printable;
+    uint32_t size;  // bytes covered; the last block may be short
+};
+
+struct summary {
+    size_t n[LEVELS];
+    struct cell* cells[LEVELS];
+};
+
+// clog2c[c] = c * log2(c), for the entropy of up to 4KiB worth of counts
+static float clog2c[(1 << SHIFT0) + 1];
+
+static void init_tables(void)
+{
+    if(clog2c[2] != 0.0f) return;
+    for(int c = 1; c <= (1 << SHIFT0); ++c) {
+        clog2c[c] = (float)((double)c * log2((double)c));
+    }
+}
+
+static void summarize(const unsigned char* p, size_t n, struct cell* out)
+{
+    uint32_t h[256];
+    memset(h, 0, sizeof(h));
+    for(size_t i = 0; i < n; ++i) h[p[i]]++;
+
+    float sum = 0.0f;
+    uint32_t printable = 0;
+    for(int c = 0; c < 256; ++c) {
+        sum += clog2c[h[c]];
+        if(c >= 0x20 && c < 0x7F) printable += h[c];
+    }
+    out->entropy = n ? (float)(log2((double)n) - sum / (double)n) : 0.0f;
+    if(out->entropy < 0.0f) out->entropy = 0.0f;
+    out->zeros = h[0];
+    out->printable = printable;
+    out->size = (uint32_t)n;
+}
+
+// level 0 blocks [from, to) get summarized in jobs of this many blocks
+#define JOB_BLOCKS 256
+
+struct build_job {
+    struct summary* s;
+    const unsigned char* mem;
+    size_t size;
+    size_t from, to;
+};
+
+static void build_one(size_t job, void* vctx)
+{
+    struct build_job* j = vctx;
+    size_t b0 = j->from + job * JOB_BLOCKS;
+    size_t b1 = b0 + JOB_BLOCKS;
+    if(b1 > j->to) b1 = j->to;
+    for(size_t b = b0; b < b1; ++b) {
+        size_t off = b << SHIFT0;
+        size_t n = j->size - off;
+        if(n > (1u << SHIFT0)) n = 1u << SHIFT0;
+        summarize(j->mem + off, n, &j->s->cells[0][b]);
+    }
+}
+
+// recompute parents of level 0 blocks [from, to)
+static void aggregate(struct summary* s, size_t from, size_t to)
+{
+    for(int l = 1; l < LEVELS; ++l) {
+        from >>= FANOUT;
+        to = (to + (1u << FANOUT) - 1) >> FANOUT;
+        if(to > s->n[l]) to = s->n[l];
+        for(size_t b = from; b < to; ++b) {
+            struct cell* c = &s->cells[l][b];
+            size_t k0 = b << FANOUT;
+            size_t k1 = k0 + (1u << FANOUT);
+            if(k1 > s->n[l - 1]) k1 = s->n[l - 1];
+            double entropy = 0.0;
+            c->zeros = c->printable = c->size = 0;
+            for(size_t k = k0; k < k1; ++k) {
+                struct cell* kid = &s->cells[l - 1][k];
+                entropy += (double)kid->entropy * (double)kid->size;
+                c->zeros += kid->zeros;
+                c->printable += kid->printable;
+                c->size += kid->size;
+            }
+            c->entropy = c->size ? (float)(entropy / (double)c->size) : 0.0f;
+        }
+    }
+}
+
+void summary_free(void* vs);
+
+// (re)allocate the levels for a buffer of size bytes. Returns 0 if out of memory
+static int resize(struct summary* s, size_t size)
+{
+    size_t n = (size + (1u << SHIFT0) - 1) >> SHIFT0;
+    for(int l = 0; l < LEVELS; ++l) {
+        if(n == 0) n = 1;
+        if(n != s->n[l] || !s->cells[l]) {
+            void* p = realloc(s->cells[l], n * sizeof(struct cell));
+            if(!p) return 0;
+            s->cells[l] = p;
+            s->n[l] = n;
+        }
+        n = (n + (1u << FANOUT) - 1) >> FANOUT;
+    }
+    return 1;
+}
+
+/** summary_update
+  *
+  * Brings the summary up to date after bytes [a1, a2) of the buffer
+  * changed. a2 may be past the end, e.g. SIZE_MAX when everything from a1
+  * onwards moved. The buffer may have changed size.
+  *
+  * Returns 0 if we ran out of memory, in which case the summary is
+  * garbage and should be freed.
+  */
+int
+summary_update(void* vs, const unsigned char* mem, size_t size, size_t a1, size_t a2)
+{
+    struct summary* s = vs;
+    if(!resize(s, size)) return 0;
+
+    size_t from = a1 >> SHIFT0;
+    size_t to = (a2 >= size) ? s->n[0] : ((a2 + (1u << SHIFT0) - 1) >> SHIFT0);
+    if(to > s->n[0]) to = s->n[0];
+    if(size == 0) {
+        memset(s->cells[0], 0, sizeof(struct cell));
+        from = 0;
+        to = 1;
+    } else if(from < to) {
+        struct build_job j = { s, mem, size, from, to };
+        size_t njobs = (to - from + JOB_BLOCKS - 1) / JOB_BLOCKS;
+        if(njobs > 1) run_parallel(njobs, build_one, &j);
+        else build_one(0, &j);
+    }
+    aggregate(s, from, to);
+    return 1;
+}
+
+/** summary_build
+  *
+  * Summarizes mem[size]. Returns NULL if we ran out of memory.
+  * Free it with summary_free().
+  */
+void*
+summary_build(const unsigned char* mem, size_t size)
+{
+    init_tables();
+    struct summary* s = calloc(1, sizeof(struct summary));
+    if(!s) return NULL;
+    if(!summary_update(s, mem, size, 0, SIZE_MAX)) {
+        summary_free(s);
+        return NULL;
+    }
+    return s;
+}
+
+/** summary_free
+  *
+  * Frees a summary. NULL is fine.
+  */
+void
+summary_free(void* vs)
+{
+    struct summary* s = vs;
+    if(!s) return;
+    for(int l = 0; l < LEVELS; ++l) free(s->cells[l]);
+    free(s);
+}
+
+/** summary_levels
+  *
+  * Returns how many levels there are. Level 0 is the finest.
+  */
+int
+summary_levels(void)
+{
+    return LEVELS;
+}
+
+/** summary_block_size
+  *
+  * Returns how many bytes a block covers at level.
+  */
+size_t
+summary_block_size(int level)
+{
+    return (size_t)1 << (SHIFT0 + FANOUT * level);
+}
+
+/** summary_blocks
+  *
+  * Returns how many blocks there are at level.
+  */
+size_t
+summary_blocks(void* vs, int level)
+{
+    struct summary* s = vs;
+    return s->n[level];
+}
+
+/** summary_get
+  *
+  * Reads back block i at level: entropy in bits per byte (0 to 8), and
+  * the fractions (0 to 1) of zero and printable ASCII bytes.
+  */
+void
+summary_get(void* vs, int level, size_t i,
+        double* entropy, double* zeros, double* printable)
+{
+    struct summary* s = vs;
+    struct cell* c = &s->cells[level][i];
+    double n = c->size ? (double)c->size : 1.0;
+    *entropy = c->entropy;
+    *zeros = (double)c->zeros / n;
+    *printable = (double)c->printable / n;
+}
@@ -0,0 +1,129 @@
+/*
+Copyright 2024 Vlad Mesco
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+// Event recorder for --trace. Events go into a fixed size ring buffer, so
+// recording costs a clock read and a copy, and a long session keeps
+// the most recent events. On exit, trace_write() dumps them in Chrome's
+// trace event JSON format, which chrome://tracing, Perfetto and friends
+// can open.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+struct event {
+    unsigned long ts;       // ns, monotonic
+    unsigned long arg;
+    const char* argname;    // NULL if there's no argument
+    char ph;                // 'B'egin, 'E'nd or 'i'nstant
+    char name[31];
+};
+
+static struct event* ring = NULL;
+static size_t capacity = 0;
+static size_t next = 0;     // where the next event goes
+static size_t count = 0;    // how many events are in the ring
+
+/** trace_open
+  *
+  * Starts recording, keeping up to nevents events.
+  * Returns 0 if we're out of memory.
+  */
+int
+trace_open(size_t nevents)
+{
+    free(ring);
+    ring = malloc(nevents * sizeof(struct event));
+    if(!ring) return 0;
+    capacity = nevents;
+    next = count = 0;
+    return 1;
+}
+
+/** trace_enabled
+  *
+  * Returns 1 if trace_open() was called.
+  */
+int
+trace_enabled(void)
+{
+    return ring != NULL;
+}
+
+/** trace_event
+  *
+  * Records an event, if recording. ph is 'B', 'E' or 'i' as in the Chrome
+  * format. name is copied (and truncated to 30 characters); argname is
+  * not, so it should be a literal. Pass argname = NULL for no argument.
+  */
+void
+trace_event(char ph, const char* name, unsigned long ts,
+        const char* argname, unsigned long arg)
+{
+    if(!ring) return;
+    struct event* e = &ring[next];
+    e->ts = ts;
+    e->ph = ph;
+    e->argname = argname;
+    e->arg = arg;
+    strncpy(e->name, name, sizeof(e->name) - 1);
+    e->name[sizeof(e->name) - 1] = '\0';
+    next = (next + 1) % capacity;
+    if(count < capacity) count++;
+}
+
+static void write_string(FILE* f, const char* s)
+{
+    fputc('"', f);
+    for(; *s; ++s) {
+        if(*s == '"' || *s == '\\') fprintf(f, "\\%c", *s);
+        else if((unsigned char)*s < 0x20) fprintf(f, "\\u%04x", (unsigned)*s);
+        else fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+/** trace_write
+  *
+  * Writes the recorded events to path in Chrome trace JSON.
+  * Returns 0 on failure, with errno set.
+  */
+int
+trace_write(const char* path)
+{
+    if(!ring) return 1;
+    FILE* f = fopen(path, "w");
+    if(!f) return 0;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    size_t first = (next + capacity - count) % capacity;
+    for(size_t i = 0; i < count; ++i) {
+        struct event* e = &ring[(first + i) % capacity];
+        fprintf(f, "{\"name\":");
+        write_string(f, e->name);
+        fprintf(f, ",\"ph\":\"%c\",\"ts\":%lu.%03lu,\"pid\":1,\"tid\":1",
+                e->ph, e->ts / 1000ul, e->ts % 1000ul);
+        if(e->ph == 'i') fprintf(f, ",\"s\":\"t\"");
+        if(e->argname) {
+            fprintf(f, ",\"args\":{");
+            write_string(f, e->argname);
+            fprintf(f, ":%lu}", e->arg);
+        }
+        fprintf(f, "}%s\n", (i + 1 < count) ? "," : "");
+    }
+    fprintf(f, "]}\n");
+
+    int ok = !ferror(f);
+    if(fclose(f) != 0) ok = 0;
+    return ok;
+}
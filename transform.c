@@ -0,0 +1,228 @@
+/*
+Copyright 2024 Vlad Mesco
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+// Bulk transforms of a range of bytes: XOR, add or subtract a repeating
+// key, fill with a repeating pattern, swap the bytes of 16, 32 or 64 bit
+// words, and reverse the bits of every byte.
+//
+// Everything goes 16 bytes at a time with SSE2 if the compiler has it,
+// and 8 bytes at a time in 64 bit words otherwise. A key of k bytes is
+// laid out 16 times over, so that it lines up with every 16 byte step
+// wherever it starts; the range is split into 1MiB jobs which run in
+// parallel, each starting at its own place in the key.
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+extern void
+run_parallel(size_t, void (*)(size_t, void*), void*);
+
+#define JOB (1u << 20)  // must be a multiple of 16
+#define LO7 0x7F7F7F7F7F7F7F7Full   // every byte but its top bit
+#define HI1 0x8080808080808080ull   // the top bit of every byte
+
+struct job {
+    unsigned char* p;
+    size_t n;
+    size_t phase;           // where in the key p[0] is
+    char op;
+    const unsigned char* pat;   // the key, 16 times over, plus 16 bytes
+    size_t npat;                // 16 times the key length
+};
+
+#ifndef __SSE2__
+static uint64_t ld64(const unsigned char* p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static void st64(unsigned char* p, uint64_t v)
+{
+    memcpy(p, &v, 8);
+}
+#endif
+
+static unsigned char revbits(unsigned char b)
+{
+    b = (unsigned char)(((b >> 1) & 0x55) | ((b & 0x55) << 1));
+    b = (unsigned char)(((b >> 2) & 0x33) | ((b & 0x33) << 2));
+    return (unsigned char)((b >> 4) | (b << 4));
+}
+
+// the ops which combine the buffer with the key
+static void keyed(struct job* j, unsigned char* p, size_t n, size_t o)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for(; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i k = _mm_loadu_si128((const __m128i*)(j->pat + o));
+        switch(j->op) {
+            case 'x': v = _mm_xor_si128(v, k); break;
+            case '+': v = _mm_add_epi8(v, k); break;
+            case '-': v = _mm_sub_epi8(v, k); break;
+            case 'f': v = k; break;
+        }
+        _mm_storeu_si128((__m128i*)(p + i), v);
+        o += 16;
+        if(o >= j->npat) o -= j->npat;
+    }
+#else
+    for(; i + 8 <= n; i += 8) {
+        uint64_t v = ld64(p + i);
+        uint64_t k = ld64(j->pat + o);
+        switch(j->op) {
+            case 'x': v ^= k; break;
+            // per byte, without carries into the next one
+            case '+': v = ((v & LO7) + (k & LO7)) ^ ((v ^ k) & HI1); break;
+            case '-': v = ((v | HI1) - (k & LO7)) ^ ((v ^ ~k) & HI1); break;
+            case 'f': v = k; break;
+        }
+        st64(p + i, v);
+        o += 8;
+        if(o >= j->npat) o -= j->npat;
+    }
+#endif
+    for(; i < n; ++i) {
+        unsigned char k = j->pat[o];
+        switch(j->op) {
+            case 'x': p[i] ^= k; break;
+            case '+': p[i] = (unsigned char)(p[i] + k); break;
+            case '-': p[i] = (unsigned char)(p[i] - k); break;
+            case 'f': p[i] = k; break;
+        }
+        if(++o >= j->npat) o -= j->npat;
+    }
+}
+
+// swap the bytes of width byte words; a partial word at the end is left
+static void swap(unsigned char* p, size_t n, int width)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for(; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        // swap 16 bit words around inside the wider ones first
+        if(width == 4) {
+            v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1);
+        } else if(width == 8) {
+            v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0x1B), 0x1B);
+        }
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128((__m128i*)(p + i), v);
+    }
+#endif
+    for(; i + (size_t)width <= n; i += (size_t)width) {
+        for(int a = 0, b = width - 1; a < b; ++a, --b) {
+            unsigned char t = p[i + a];
+            p[i + a] = p[i + b];
+            p[i + b] = t;
+        }
+    }
+}
+
+static void reverse(unsigned char* p, size_t n)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i m1 = _mm_set1_epi8(0x55);
+    const __m128i m2 = _mm_set1_epi8(0x33);
+    const __m128i m4 = _mm_set1_epi8(0x0F);
+    for(; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        // the masks throw away whatever shifts in from the next byte
+        v = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 1), m1),
+                _mm_slli_epi16(_mm_and_si128(v, m1), 1));
+        v = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 2), m2),
+                _mm_slli_epi16(_mm_and_si128(v, m2), 2));
+        v = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 4), m4),
+                _mm_slli_epi16(_mm_and_si128(v, m4), 4));
+        _mm_storeu_si128((__m128i*)(p + i), v);
+    }
+#else
+    const uint64_t m1 = 0x5555555555555555ull;
+    const uint64_t m2 = 0x3333333333333333ull;
+    const uint64_t m4 = 0x0F0F0F0F0F0F0F0Full;
+    for(; i + 8 <= n; i += 8) {
+        uint64_t v = ld64(p + i);
+        v = ((v >> 1) & m1) | ((v & m1) << 1);
+        v = ((v >> 2) & m2) | ((v & m2) << 2);
+        v = ((v >> 4) & m4) | ((v & m4) << 4);
+        st64(p + i, v);
+    }
+#endif
+    for(; i < n; ++i) p[i] = revbits(p[i]);
+}
+
+static void run_job(size_t i, void* ctx)
+{
+    struct job* j = ctx;
+    size_t from = i * JOB;
+    size_t n = (j->n - from < JOB) ? j->n - from : JOB;
+    unsigned char* p = j->p + from;
+    switch(j->op) {
+        case 'x': case '+': case '-': case 'f':
+            keyed(j, p, n, (j->phase + from) % j->npat);
+            break;
+        case '2': case '4': case '8':
+            swap(p, n, j->op - '0');
+            break;
+        case 'r':
+            reverse(p, n);
+            break;
+    }
+}
+
+/** transform
+  *
+  * Transforms p[0, n) in place. op is one of
+  *     x   XOR with the key
+  *     +   add the key, byte by byte
+  *     -   subtract the key, byte by byte
+  *     f   fill with the key
+  *     2, 4 or 8   swap the bytes of 16, 32 or 64 bit words
+  *     r   reverse the bits of every byte
+  * The key repeats every nkey bytes and p[0] goes with key[phase % nkey],
+  * so a big range can be done a piece at a time. Words are counted from
+  * p[0], so pieces should be a multiple of 8 bytes long.
+  *
+  * Returns 0 if we ran out of memory or the op needs a key and there's
+  * none, in which case nothing was done.
+  */
+int
+transform(unsigned char* p, size_t n, size_t phase, char op,
+        const unsigned char* key, size_t nkey)
+{
+    struct job j = { p, n, 0, op, NULL, 0 };
+    unsigned char* pat = NULL;
+    if(op == 'x' || op == '+' || op == '-' || op == 'f') {
+        if(nkey == 0) return 0;
+        j.npat = 16 * nkey;
+        pat = malloc(j.npat + 16);
+        if(!pat) return 0;
+        for(size_t i = 0; i < j.npat + 16; ++i) pat[i] = key[i % nkey];
+        j.pat = pat;
+        j.phase = phase % nkey;
+    }
+    size_t njobs = (n + JOB - 1) / JOB;
+    if(njobs > 1) run_parallel(njobs, run_job, &j);
+    else if(njobs) run_job(0, &j);
+    free(pat);
+    return 1;
+}
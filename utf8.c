@@ -0,0 +1,172 @@
+/*
+Copyright 2024 Vlad Mesco
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+// Finds invalid UTF-8, forwards or backwards from some position, and says
+// what's wrong with it. Sequences are checked against table 3-7 of the
+// Unicode standard, so overlong encodings, surrogates and code points past
+// U+10FFFF are all errors. After an error, decoding picks up again at the
+// next byte.
+//
+// Text is mostly ASCII, so 64 bytes at a time get checked for the high bit
+// first (with SSE2 if the compiler has it, in 64 bit words otherwise) and
+// only the blocks which have some non-ASCII get decoded one sequence at a
+// time.
+
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+// length of the valid sequence at p[n], or 0 with the reason in *why
+static size_t decode(const unsigned char* p, size_t n, const char** why)
+{
+    unsigned char c = p[0];
+    size_t len;
+    unsigned char lo = 0x80, hi = 0xBF;   // range of the second byte
+    if(c < 0x80) return 1;
+    if(c < 0xC0) {
+        *why = "stray continuation byte";
+        return 0;
+    } else if(c < 0xC2) {
+        *why = "overlong encoding";
+        return 0;
+    } else if(c < 0xE0) {
+        len = 2;
+    } else if(c < 0xF0) {
+        len = 3;
+        if(c == 0xE0) lo = 0xA0;
+        if(c == 0xED) hi = 0x9F;
+    } else if(c < 0xF5) {
+        len = 4;
+        if(c == 0xF0) lo = 0x90;
+        if(c == 0xF4) hi = 0x8F;
+    } else {
+        *why = "byte never appears in UTF-8";
+        return 0;
+    }
+
+    for(size_t k = 1; k < len; ++k) {
+        if(k >= n) {
+            *why = "sequence cut short by the end of the buffer";
+            return 0;
+        }
+        if((p[k] & 0xC0) != 0x80) {
+            *why = "missing continuation byte";
+            return 0;
+        }
+    }
+    if(p[1] < lo) {
+        *why = "overlong encoding";
+        return 0;
+    }
+    if(p[1] > hi) {
+        *why = (c == 0xED) ? "UTF-16 surrogate" : "code point past U+10FFFF";
+        return 0;
+    }
+    return len;
+}
+
+// where the first invalid sequence starting in [i, stop) is, or stop;
+// sequences may run past stop, up to n
+static size_t check(const unsigned char* p, size_t n, size_t i, size_t stop, const char** why)
+{
+    while(i < stop) {
+#ifdef __SSE2__
+        while(i + 64 <= stop) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(p + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(p + i + 16));
+            __m128i c = _mm_loadu_si128((const __m128i*)(p + i + 32));
+            __m128i d = _mm_loadu_si128((const __m128i*)(p + i + 48));
+            __m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+            if(_mm_movemask_epi8(any)) break;
+            i += 64;
+        }
+#else
+        while(i + 64 <= stop) {
+            uint64_t w[8];
+            memcpy(w, p + i, sizeof(w));
+            uint64_t any = w[0] | w[1] | w[2] | w[3] | w[4] | w[5] | w[6] | w[7];
+            if(any & 0x8080808080808080ull) break;
+            i += 64;
+        }
+#endif
+        // either the block with the non-ASCII, or the tail
+        size_t end = (i + 64 < stop) ? i + 64 : stop;
+        while(i < end) {
+            size_t len = decode(p + i, n - i, why);
+            if(!len) return i;
+            i += len;
+        }
+    }
+    return stop;
+}
+
+// back up from i over at most 3 continuation bytes, to where a sequence
+// might start
+static size_t sync(const unsigned char* p, size_t i)
+{
+    for(int k = 0; k < 3 && i > 0 && (p[i] & 0xC0) == 0x80; ++k) --i;
+    return i;
+}
+
+/** utf8_next_invalid
+  *
+  * Returns where the first invalid UTF-8 sequence at or after `from'
+  * starts, with the reason in *why, or n if there isn't one.
+  */
+size_t
+utf8_next_invalid(const unsigned char* p, size_t n, size_t from, const char** why)
+{
+    if(from >= n) return n;
+    size_t i = sync(p, from);
+    for(;;) {
+        size_t e = check(p, n, i, n, why);
+        if(e >= from) return e;
+        i = e + 1;
+    }
+}
+
+/** utf8_prev_invalid
+  *
+  * Returns where the last invalid UTF-8 sequence starting before `before'
+  * starts, with the reason in *why, or n if there isn't one.
+  *
+  * Works back in 64KiB chunks, each decoded forwards from the first
+  * sequence boundary in it.
+  */
+size_t
+utf8_prev_invalid(const unsigned char* p, size_t n, size_t before, const char** why)
+{
+    const size_t chunk = 64 * 1024;
+    size_t end = (before < n) ? before : n;
+    while(end > 0) {
+        size_t s = sync(p, (end > chunk) ? end - chunk : 0);
+        size_t last = n;
+        const char* lastwhy = NULL;
+        for(size_t i = s; ; ) {
+            const char* w = NULL;
+            size_t e = check(p, n, i, end, &w);
+            if(e >= end) break;
+            last = e;
+            lastwhy = w;
+            i = e + 1;
+        }
+        if(last < n) {
+            *why = lastwhy;
+            return last;
+        }
+        end = s;
+    }
+    return n;
+}